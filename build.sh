@@ -3,7 +3,15 @@
 set -e
 
 VERBOSE_LEVEL=1
+USE_CACHE=false
+JOBS=$(nproc)
 STEPS=()
+STEP_INPUTS=()
+STEP_READS=()
+STEP_OUTPUTS=()
+STEP_ENV=()
+STEP_FLAGS=()
+STEP_KEYS=()
 
 # Custom color echo function, use for debugging
 log() {
@@ -31,49 +39,407 @@ error() {
     umount -l $CHROOT/run
     log 2 "Done"
 
+    if findmnt "$CHROOT" > /dev/null; then
+        log 2 "Unmounting layers"
+        umount -l $CHROOT
+        umount -l $LAYER_BASE
+        log 2 "Done"
+    fi
+
 	exit "${code}"
 }
 
 trap 'error ${LINENO}' ERR
 
+reset_steps() {
+    STEPS=()
+    STEP_INPUTS=()
+    STEP_READS=()
+    STEP_OUTPUTS=()
+    STEP_ENV=()
+    STEP_FLAGS=()
+}
+
+# add_step <name> <command> [--inputs "<paths>"] [--reads "<paths>"] [--outputs "<paths>"]
+#                           [--env "<vars>"] [--checkpoint] [--no-key]
+#   --inputs      Files or directories whose content is part of the step key
+#   --reads       Paths the step reads but that are not part of the step key
+#   --outputs     Paths the step writes. Steps without outputs run alone, after
+#                 every step added before them
+#   --env         Variables whose value is part of the step key
+#   --checkpoint  Snapshot $CHROOT after the step so later builds can resume from it
+#   --no-key      Step does not affect the build result (host setup, downloads)
 add_step() {
     local step_name=$1
     local step_command=$2
+    shift 2
+
+    local step_inputs=""
+    local step_reads=""
+    local step_outputs=""
+    local step_env=""
+    local step_flags=""
+
+    while [ $# -gt 0 ]; do
+    case $1 in
+        --inputs)
+            shift
+            step_inputs=$1
+            ;;
+        --reads)
+            shift
+            step_reads=$1
+            ;;
+        --outputs)
+            shift
+            step_outputs=$1
+            ;;
+        --env)
+            shift
+            step_env=$1
+            ;;
+        --checkpoint)
+            step_flags="$step_flags checkpoint"
+            ;;
+        --no-key)
+            step_flags="$step_flags nokey"
+            ;;
+    esac
+    shift
+    done
+
     STEPS+=("$step_name" "$step_command")
+    STEP_INPUTS+=("$step_inputs")
+    STEP_READS+=("$step_reads")
+    STEP_OUTPUTS+=("$step_outputs")
+    STEP_ENV+=("$step_env")
+    STEP_FLAGS+=("$step_flags")
 }
 
+# Full output always goes to the step log file
 run_command() {
     local command=$1
+    local log_file=$2
+    local tee_fd tee_pid status=0
 
+    # Both streams append to the truncated log, so stdout does not overwrite stderr
+    : > "$log_file"
     if [[ $VERBOSE_LEVEL -eq 0 ]]; then
-        eval "$command" &> /dev/null  # Run silently
+        exec {tee_fd}>> "$log_file"  # Run silently
     elif [[ $VERBOSE_LEVEL -eq 1 ]]; then
-        eval "$command" 1> /dev/null  # Supress stdout
+        exec {tee_fd}> >(tee -a "$log_file" >&2)  # Supress stdout
+        tee_pid=$!
+    else
+        exec {tee_fd}> >(tee -a "$log_file")  # Full output for log level 2
+        tee_pid=$!
+    fi
+
+    # The command runs as a job rather than in an "|| status=$?" list, which would turn off set -e inside it
+    if [[ $VERBOSE_LEVEL -eq 1 ]]; then
+        eval "$command" 1>> "$log_file" 2>&$tee_fd &
+    else
+        eval "$command" 1>&$tee_fd 2>&1 &
+    fi
+    wait $! || status=$?
+
+    # Wait for tee, so the log is complete when it is shown on failure
+    exec {tee_fd}>&-
+    if [ -n "$tee_pid" ]; then
+        wait $tee_pid || true
+    fi
+    return $status
+}
+
+step_has_flag() {
+    local index=$1
+    local flag=$2
+    [[ " ${STEP_FLAGS[index]} " == *" $flag "* ]]
+}
+
+step_slug() {
+    echo -n "$1" | tr -c 'A-Za-z0-9' '-'
+}
+
+json_escape() {
+    echo -n "$1" | sed -e 's/\\/\\\\/g' -e 's/"/\\"/g'
+}
+
+# Print the content hash of a file or directory.
+# File hashes are memoized on path, size and mtime so the ICPC ISO is only read once.
+hash_path() {
+    local path=$1
+
+    if [ -d "$path" ]; then
+        # Build artifacts are derived from sources that are hashed already
+        (cd "$path" && find . -type f ! -name '*.o' ! -name '*.so' -print0 \
+            | LC_ALL=C sort -z | xargs -0 -r sha256sum) | sha256sum | cut -d' ' -f1
+    elif [ -f "$path" ]; then
+        local memo="$CACHE_DIR/hashes/$(echo "$(realpath "$path") $(stat -c '%s %Y' "$path")" | sha256sum | cut -d' ' -f1)"
+        if [ ! -f "$memo" ]; then
+            mkdir -p "$CACHE_DIR/hashes"
+            sha256sum < "$path" | cut -d' ' -f1 > "$memo"
+        fi
+        cat "$memo"
     else
-        eval "$command"  # Full output for log level 2
+        echo "missing"
+    fi
+}
+
+# HMAC-SHA256 of stdin with the secret in $CACHE_DIR/key. Step keys are published in the
+# build report, and variables such as SUPER_PASSWD must not be recoverable from them.
+hmac_sha256() {
+    if [ ! -f "$CACHE_DIR/key" ]; then
+        mkdir -p "$CACHE_DIR"
+        (umask 077 && head -c 32 /dev/urandom > "$CACHE_DIR/key")
+    fi
+    python3 -c 'import hmac, sys; print(hmac.new(open(sys.argv[1], "rb").read(), sys.stdin.buffer.read(), "sha256").hexdigest())' "$CACHE_DIR/key"
+}
+
+# Each step key covers its command, declared inputs and variables, and the key of
+# the step before it, so a change invalidates every step that follows.
+compute_step_keys() {
+    local chain=""
+    STEP_KEYS=()
+
+    for (( i = 0; i < ${#STEPS[@]} ; i += 2 )); do
+        local index=$(( i / 2 ))
+
+        if ! step_has_flag $index nokey; then
+            chain=$(
+                echo "$chain"
+                echo "${STEPS[i+1]}"
+                for var in ${STEP_ENV[index]}; do
+                    echo "$var=${!var}"
+                done
+                for input in ${STEP_INPUTS[index]}; do
+                    echo "$input $(hash_path "$input")"
+                done
+            )
+            chain=$(echo "$chain" | hmac_sha256)
+        fi
+
+        STEP_KEYS+=("$chain")
+    done
+}
+
+# Succeeds if one of the paths in $1 is equal to or inside one of the paths in $2, or vice versa
+paths_overlap() {
+    local a b
+    for a in $1; do
+        a=$(realpath -m "$a")
+        for b in $2; do
+            b=$(realpath -m "$b")
+            if [[ "$a/" == "$b/"* ]] || [[ "$b/" == "$a/"* ]]; then
+                return 0
+            fi
+        done
+    done
+    return 1
+}
+
+# A step depends on an earlier step if either of them has no declared outputs,
+# or if one of them writes a path the other one reads or writes.
+compute_step_deps() {
+    local total_steps=$(( ${#STEPS[@]} / 2 ))
+    STEP_DEPS=()
+
+    for (( j = 0; j < total_steps; j++ )); do
+        local deps=""
+        local reads_j="${STEP_INPUTS[j]} ${STEP_READS[j]}"
+
+        for (( i = 0; i < j; i++ )); do
+            local reads_i="${STEP_INPUTS[i]} ${STEP_READS[i]}"
+
+            if [ -z "${STEP_OUTPUTS[i]}" ] || [ -z "${STEP_OUTPUTS[j]}" ] \
+                || paths_overlap "${STEP_OUTPUTS[i]}" "$reads_j ${STEP_OUTPUTS[j]}" \
+                || paths_overlap "${STEP_OUTPUTS[j]}" "$reads_i"; then
+                deps="$deps $i"
+            fi
+        done
+
+        STEP_DEPS+=("$deps")
+    done
+}
+
+# Restore $CHROOT from the latest checkpoint whose key still matches.
+# Prints the index of the restored step, or -1 if nothing could be restored.
+restore_checkpoint() {
+    for (( index = ${#STEP_KEYS[@]} - 1; index >= 0; index-- )); do
+        if ! step_has_flag $index checkpoint; then
+            continue
+        fi
+
+        local snapshot="$CACHE_DIR/snapshots/$(step_slug "${STEPS[index*2]}")"
+        if [ -f "$snapshot.key" ] && [ "$(cat "$snapshot.key")" = "${STEP_KEYS[index]}" ]; then
+            log 1 "Restoring checkpoint: ${STEPS[index*2]}" >&2
+            rm -rf $CHROOT
+            cp -a --reflink=auto "$snapshot" $CHROOT
+            echo $index
+            return
+        fi
+    done
+
+    echo -1
+}
+
+save_checkpoint() {
+    local index=$1
+    local snapshot="$CACHE_DIR/snapshots/$(step_slug "${STEPS[index*2]}")"
+
+    log 2 "Saving checkpoint to $snapshot"
+    mkdir -p "$CACHE_DIR/snapshots"
+    rm -rf "$snapshot" "$snapshot.key"
+    cp -a --reflink=auto $CHROOT "$snapshot"
+    echo "${STEP_KEYS[index]}" > "$snapshot.key"
+}
+
+report_step() {
+    mkdir -p "$(dirname "$BUILD_REPORT")"
+    printf '{"phase":"%s","step":%d,"name":"%s","key":"%s","status":"%s","deps":[%s],"start_ms":%d,"elapsed_ms":%d,"checkpoint_ms":%d,"log":"%s"}\n' \
+        "$(json_escape "$1")" "$2" "$(json_escape "$3")" "$4" "$5" "$6" "$7" "$8" "$9" "$(json_escape "${10}")" >> "$BUILD_REPORT"
+}
+
+# Runs in a subshell, so a failing command only fails this step
+run_step() {
+    local index=$1
+    local log_file=$2
+    local start_time=$(date +%s%3N)
+
+    run_command "${STEPS[index*2+1]}" "$log_file"
+
+    if [ $USE_CACHE = true ] && step_has_flag $index checkpoint; then
+        local end_time=$(date +%s%3N)
+        save_checkpoint $index >> "$log_file"
+        echo $(( $(date +%s%3N) - end_time )) > "$log_file.checkpoint_ms"
     fi
 }
 
+# Walk back from the step that finished last, each time following the
+# dependency that finished last.
+print_critical_path() {
+    local phase_time=$1
+    local index=-1
+    local path=""
+    local path_time=0
+
+    for (( i = 0; i < ${#STEP_END[@]}; i++ )); do
+        if [[ $index -lt 0 ]] || [[ ${STEP_END[i]} -gt ${STEP_END[index]} ]]; then
+            index=$i
+        fi
+    done
+
+    while [[ $index -ge 0 ]]; do
+        local elapsed=$(( STEP_END[index] - STEP_START[index] ))
+        path_time=$(( path_time + elapsed ))
+        path="${STEPS[index*2]} ($(( elapsed / 1000 ))s)${path:+ -> $path}"
+
+        local next=-1
+        for dep in ${STEP_DEPS[index]}; do
+            if [[ $next -lt 0 ]] || [[ ${STEP_END[dep]} -gt ${STEP_END[next]} ]]; then
+                next=$dep
+            fi
+        done
+        index=$next
+    done
+
+    log 1 "Critical path: $(( path_time / 1000 ))s of $(( phase_time / 1000 ))s wall time"
+    log 2 "$path"
+}
+
+# Runs every step as soon as the steps it depends on have finished, with at most $JOBS steps at a time
 run_all_steps() {
+    local phase=$1
     local total_steps=$(( ${#STEPS[@]} / 2 ))  # Each step is a tuple of 2 strings
-    local current_step=0
+    local resume_from=-1
+    local log_dir="$STEP_LOG_DIR/$phase"
+    local phase_start=$(date +%s%3N)
 
-    for (( i = 0; i < ${#STEPS[@]} ; i += 2 )); do
-        current_step=$((current_step + 1))
-        local step_name=${STEPS[i]}
-        local step_command=${STEPS[i+1]}
+    if [ $USE_CACHE = true ]; then
+        compute_step_keys
+        resume_from=$(restore_checkpoint)
+    fi
 
-        log 1 "Step $current_step/$total_steps: $step_name"
+    compute_step_deps
+
+    rm -rf "$log_dir"
+    mkdir -p "$log_dir"
+
+    local -a state=()
+    local -A running=()  # pid -> step index
+    STEP_START=()
+    STEP_END=()
+    STEP_LOG=()
+
+    for (( index = 0; index < total_steps; index++ )); do
+        if [[ $index -le $resume_from ]]; then
+            log 1 "Step $(( index + 1 ))/$total_steps: ${STEPS[index*2]} (cached)"
+            state[index]=done
+            STEP_START[index]=0
+            STEP_END[index]=0
+            report_step "$phase" $(( index + 1 )) "${STEPS[index*2]}" "${STEP_KEYS[index]:-}" cached \
+                "$(echo ${STEP_DEPS[index]} | tr ' ' ',')" 0 0 0 ""
+        else
+            state[index]=pending
+        fi
+    done
 
-        local start_time=$(date +%s)
+    local finished=$(( resume_from + 1 ))
+    while [[ $finished -lt $total_steps ]]; do
+        for (( index = 0; index < total_steps && ${#running[@]} < JOBS; index++ )); do
+            if [ ${state[index]} != pending ]; then
+                continue
+            fi
 
-        run_command "$step_command"
+            local ready=true
+            for dep in ${STEP_DEPS[index]}; do
+                if [ ${state[dep]} != done ]; then
+                    ready=false
+                    break
+                fi
+            done
+            if [ $ready = false ]; then
+                continue
+            fi
 
-        local end_time=$(date +%s)
-        local elapsed_time=$(( end_time - start_time ))
+            log 1 "Step $(( index + 1 ))/$total_steps: ${STEPS[index*2]}"
+            STEP_LOG[index]="$log_dir/$(printf '%02d' $(( index + 1 )))-$(step_slug "${STEPS[index*2]}").log"
+            STEP_START[index]=$(date +%s%3N)
+            run_step $index "${STEP_LOG[index]}" &
+            running[$!]=$index
+            state[index]=running
+        done
+
+        local finished_pid
+        local status=0
+        wait -n -p finished_pid "${!running[@]}" || status=$?
+
+        index=${running[$finished_pid]}
+        unset "running[$finished_pid]"
+        STEP_END[index]=$(date +%s%3N)
+        state[index]=done
+        finished=$(( finished + 1 ))
+
+        local log_file=${STEP_LOG[index]}
+        local elapsed_time=$(( STEP_END[index] - STEP_START[index] ))
+        local checkpoint_time=$(cat "$log_file.checkpoint_ms" 2> /dev/null || echo 0)
+
+        log 2 "Finished ${STEPS[index*2]}. Elapsed time: $(( elapsed_time / 1000 )) seconds"
 
-        log 2 "Elapsed time: ${elapsed_time} seconds"
+        report_step "$phase" $(( index + 1 )) "${STEPS[index*2]}" "${STEP_KEYS[index]:-}" \
+            "$([ $status -eq 0 ] && echo run || echo failed)" "$(echo ${STEP_DEPS[index]} | tr ' ' ',')" \
+            $(( STEP_START[index] - phase_start )) $elapsed_time $checkpoint_time "$log_file"
+
+        if [[ $status -ne 0 ]]; then
+            if [[ ${#running[@]} -gt 0 ]]; then
+                kill "${!running[@]}" 2> /dev/null || true
+                wait "${!running[@]}" || true
+            fi
+            tail -n 20 "$log_file"
+            error ${LINENO} "Step \"${STEPS[index*2]}\" failed, see $log_file" $status
+        fi
     done
+
+    print_critical_path $(( $(date +%s%3N) - phase_start ))
 }
 
 # Install requested packages if system has apt
@@ -113,11 +479,40 @@ else
     source config.sh
 fi
 
+CACHE_DIR=${CACHE_DIR:-$INS_DIR/cache}
+BUILD_REPORT=${BUILD_REPORT:-$INS_DIR/build-report.jsonl}
+STORE_DIR=${STORE_DIR:-$INS_DIR/store}
+STEP_LOG_DIR=${STEP_LOG_DIR:-$INS_DIR/logs}
+LAYER_BASE=${LAYER_BASE:-$INS_DIR/layers/base}
+LAYER_UPPER=${LAYER_UPPER:-$INS_DIR/layers/upper}
+LAYER_WORK=${LAYER_WORK:-$INS_DIR/layers/work}
+
 if $(findmnt -rno SOURCE,TARGET "$CHROOT/dev" > /dev/null); then
     sudo umount -l $CHROOT/dev
     sudo umount -l $CHROOT/run
 fi
 
+# Layered builds keep the ICPC filesystem untouched and collect the VNOI changes
+# in the upper directory of an overlay mounted at $CHROOT
+mount_layers() {
+    mkdir -p $LAYER_BASE $LAYER_UPPER $LAYER_WORK
+    mount -t squashfs -o loop,ro $ICPC/casper/filesystem.squashfs $LAYER_BASE
+    mount -t overlay overlay -o lowerdir=$LAYER_BASE,upperdir=$LAYER_UPPER,workdir=$LAYER_WORK $CHROOT
+}
+
+umount_layers() {
+    umount -l $CHROOT
+    umount -l $LAYER_BASE
+}
+
+if $(findmnt "$CHROOT" > /dev/null); then
+    sudo umount -l $CHROOT
+fi
+
+if $(findmnt "$LAYER_BASE" > /dev/null); then
+    sudo umount -l $LAYER_BASE
+fi
+
 build_modules() {
     log 0 "Building modules"
 
@@ -131,11 +526,16 @@ build_modules() {
 
 icpc_build() {
     log 1 "Start icpc_build"
-    STEPS=()
+    reset_steps
 
     FORCE_DOWNLOAD=false
     CLEAR_EARLY=false
-    COMPACT=false
+    COMP="gzip"
+    COMP_LEVEL=""
+    BLOCK_SIZE=""
+    SORT_FILE=""
+    PUBLISH_STORE=false
+    LAYERED=false
     PROD_DEV="prod"
     APT_SOURCE="vnoi"
 
@@ -175,7 +575,44 @@ icpc_build() {
             APT_SOURCE="icpc"
             ;;
         --compact)
-            COMPACT=true
+            COMP="xz"
+            ;;
+        --comp)
+            shift
+            COMP=$1
+            if [[ ! $COMP =~ ^(gzip|xz|zstd)$ ]]; then
+                echo "Unknown compression \"$COMP\", must be gzip, xz or zstd" 1>&2
+                exit 1
+            fi
+            ;;
+        --comp-level)
+            shift
+            COMP_LEVEL=$1
+            ;;
+        --block-size)
+            shift
+            BLOCK_SIZE=$1
+            ;;
+        --sort-file)
+            shift
+            SORT_FILE=$(realpath "$1")
+            ;;
+        --publish-store)
+            PUBLISH_STORE=true
+            ;;
+        --layered)
+            LAYERED=true
+            ;;
+        --cache)
+            USE_CACHE=true
+            ;;
+        -j | --jobs)
+            shift
+            JOBS=$1
+            if [[ ! $JOBS =~ ^[1-9][0-9]*$ ]]; then
+                echo "-j must be a positive integer, got \"$JOBS\"" 1>&2
+                exit 1
+            fi
             ;;
         -h | --help)
             echo "Usage: $0 icpc_build [-u|--url <url>] [-f|--force]"
@@ -189,6 +626,17 @@ icpc_build() {
             echo "  --github-actions   Clear early to free up space"
             echo "  --vnoi-source      Use VNOI and Ubuntu sources"
             echo "  --icpc-source      Use ICPC sources"
+            echo "  --compact          Compress filesystem with xz (slow, smaller size), same as --comp xz"
+            echo "  --comp <comp>      Compress filesystem with gzip (default), xz or zstd"
+            echo "  --comp-level <n>   Compression level for gzip (1-9) or zstd (1-22, default: 15)"
+            echo "  --block-size <n>   Squashfs block size in bytes (default: 131072 for gzip, 1048576 for xz and zstd)"
+            echo "  --sort-file <file> Place files listed in <file> first in the filesystem (see dev_boot_trace)"
+            echo "  --publish-store    Publish the ISO as a chunk index and store for image-sync.sh"
+            echo "  --layered          Keep the ICPC filesystem as is and ship the changes as a separate layer."
+            echo "                     For live sessions and development only: the installer copies the ICPC"
+            echo "                     filesystem alone, so installed machines would not get the changes"
+            echo "  --cache            Skip steps whose inputs are unchanged, resuming from the latest chroot checkpoint"
+            echo "  -j, --jobs <n>     Run up to <n> independent steps at the same time (default: number of CPUs)"
             echo "  -h, --help         Show this help"
             exit 0
             ;;
@@ -196,6 +644,35 @@ icpc_build() {
     shift
     done
 
+    if [ $USE_CACHE = true ] && [ $CLEAR_EARLY = true ]; then
+        log 1 "--cache cannot be used with --github-actions, disabling cache"
+        USE_CACHE=false
+    fi
+
+    if [ $LAYERED = true ] && [ $CLEAR_EARLY = true ]; then
+        echo "--layered cannot be used with --github-actions" 1>&2
+        exit 1
+    fi
+
+    # Ubiquity installs from /rofs, where casper mounts a single squashfs instead of the merged
+    # layers, so a layered image is only usable as a live session
+    if [ $LAYERED = true ]; then
+        log 1 "--layered images are for live sessions and development, do not use them to install contestant machines"
+    fi
+
+    # Checkpoints copy $CHROOT, which is only a mount point in layered builds
+    if [ $USE_CACHE = true ] && [ $LAYERED = true ]; then
+        log 1 "--cache cannot be used with --layered, disabling cache"
+        USE_CACHE=false
+    fi
+
+    if [ $PUBLISH_STORE = true ] && [ ! -x "$(command -v desync)" ]; then
+        echo "desync not found, install it with: go install github.com/folbricht/desync/cmd/desync@latest" 1>&2
+        exit 1
+    fi
+
+    rm -f "$BUILD_REPORT"
+
     ICPC_ISO_FILENAME="icpc-image.iso"
     if [ ! -f $ICPC_ISO_FILENAME ] || [ $FORCE_DOWNLOAD = true ]; then
         add_step "Downloading ICPC image" "$(cat <<"EOM"
@@ -210,9 +687,16 @@ if [ ! isoinfo -d -i filename.iso > /dev/null 2>&1 ]; then
     exit 1
 fi
 EOM
-        )"
+        )" --outputs "$ICPC_ISO_FILENAME /var/lib/dpkg /usr" --no-key
+
+        # Run on its own before the other steps, so their keys are computed from the
+        # downloaded ISO and a checkpoint of the previous ISO is not restored
+        run_all_steps icpc_download
+        reset_steps
     fi
 
+    # No outputs, so this runs after the download and before every later step,
+    # which all use the host tools it installs (7z, unsquashfs, mksquashfs, ...)
     add_step "Installing packages" "install_if_has_apt \
         binutils \
         squashfs-tools \
@@ -229,18 +713,32 @@ EOM
         libpam0g-dev \
         libsystemd-dev \
         libcurl4-openssl-dev
-    "
+    " --no-key
 
-    add_step "Creating directories and removing old chroot" 'mkdir -p $INS_DIR/{chroot,image/{casper,install},icpc} && rm -rf $CHROOT/*'
+    add_step "Creating directories and removing old chroot" 'mkdir -p $INS_DIR/{chroot,image/{casper,install},icpc} && rm -rf $CHROOT/*' \
+        --outputs "$CHROOT $IMAGE $ICPC"
 
     # Extract ISO to chroot
     add_step "Extract MBR from ISO" "$(cat <<"EOM"
 7z x $ICPC_ISO_FILENAME -o$INS_DIR/icpc -aoa -mnt4
 dd if="$ICPC_ISO_FILENAME" bs=1 count=446 of="$INS_DIR/icpc/contestant.mbr"
 EOM
-    )"
+    )" --inputs "$ICPC_ISO_FILENAME" --outputs "$ICPC"
 
-    add_step "Extracting squashfs filesystem from ISO" 'unsquashfs -f -d $CHROOT $ICPC/casper/filesystem.squashfs'
+    if [ $LAYERED = true ]; then
+        add_step "Mounting squashfs filesystem from ISO as base layer" 'rm -rf $LAYER_UPPER $LAYER_WORK && mount_layers' \
+            --reads "$ICPC" --outputs "$CHROOT $LAYER_BASE $LAYER_UPPER $LAYER_WORK"
+    else
+        add_step "Extracting squashfs filesystem from ISO" 'unsquashfs -f -d $CHROOT $ICPC/casper/filesystem.squashfs' \
+            --reads "$ICPC" --outputs "$CHROOT" --checkpoint
+    fi
+
+    # Added after the first checkpoint so a modules/pam change does not invalidate the
+    # extracted chroot, it still runs alongside the extraction since it only writes modules/pam
+    if [ $PROD_DEV = "prod" ]; then
+        add_step "Build PAM modules" 'build_modules' --inputs "modules/pam" --reads "/usr" \
+            --outputs "modules/pam $TOOLKIT/misc/vnoi_pam.so"
+    fi
 
     if [ $CLEAR_EARLY = true ]; then
         add_step "Clearing early to free up space" 'rm -rf $ICPC/casper/filesystem.squashfs'
@@ -251,11 +749,10 @@ EOM
         mount --make-rslave --bind /run \$CHROOT/run \
     "
 
-    add_step "Copy scripts and config to chroot" 'cp -R build.sh chroot_install.sh $CHROOT/root'
+    add_step "Copy scripts and config to chroot" 'cp -R build.sh chroot_install.sh $CHROOT/root' --inputs "build.sh chroot_install.sh"
 
     if [ $PROD_DEV = "prod" ]; then
-        add_step "Build PAM modules" 'build_modules'
-        add_step "Copy toolkit to chroot" 'cp -R $TOOLKIT/ $CHROOT/root/src/'
+        add_step "Copy toolkit to chroot" 'cp -R $TOOLKIT/ $CHROOT/root/src/' --inputs "$TOOLKIT"
     else
         add_step "Skipped copying toolkit to chroot" 'mkdir -p $CHROOT/root/src'
     fi
@@ -266,7 +763,7 @@ GRUB_PASSWD=$(echo -e "$SUPER_PASSWD\n$SUPER_PASSWD" | grub-mkpasswd-pbkdf2 | aw
 echo "ENCRYPTED_SUPER_PASSWD='$ENCRYPTED_SUPER_PASSWD'" > $CHROOT/root/src/encrypted_passwd.sh
 echo "GRUB_PASSWD='$GRUB_PASSWD'" >> $CHROOT/root/src/encrypted_passwd.sh
 EOM
-    )"
+    )" --env "SUPER_PASSWD"
 
     if [ $APT_SOURCE = "vnoi" ]; then
         add_step "Making apt use VNOI and Ubuntu sources" "$(cat <<"EOM"
@@ -282,9 +779,9 @@ for file in $CHROOT/etc/apt/sources.list.d/*; do
     sed -i "s|https://sysopspackages.icpc.global|$CUSTOM_APT_SOURCE|g" $file
 done
 EOM
-        )"
+        )" --env "UBUNTU_APT_SOURCE CUSTOM_APT_SOURCE"
 
-        add_step "Make VNOI key trusted" 'curl $CUSTOM_APT_SOURCE/pubkey.txt | gpg --dearmor > $CHROOT/etc/apt/trusted.gpg.d/vnoi.gpg'
+        add_step "Make VNOI key trusted" 'curl $CUSTOM_APT_SOURCE/pubkey.txt | gpg --dearmor > $CHROOT/etc/apt/trusted.gpg.d/vnoi.gpg' --env "CUSTOM_APT_SOURCE"
     fi
 
     add_step "chrooting into $CHROOT" "$(cat <<"EOM"
@@ -299,27 +796,53 @@ su -c "chroot $CHROOT /usr/bin/env -i \
     PROD_DEV="$PROD_DEV" \
     /bin/bash /root/chroot_install.sh"
 EOM
-    )"
+    )" --env "PROD_DEV"
 
     add_step "Cleanup scripts and config from chroot" 'rm -f $CHROOT/root/{build.sh,chroot_install.sh,config.sh,config.local.sh,authorized_keys}'
 
     add_step "Unmounting /dev and /run from chroot" " \
         umount -l \$CHROOT/dev; \
         umount -l \$CHROOT/run \
-    "
+    " --checkpoint
 
     if [ $CLEAR_EARLY = true ]; then
         add_step "Clearing early to free up space" 'rm -rf $ICPC_ISO_FILENAME'
     fi
 
-    run_all_steps
+    run_all_steps icpc_build
 
     icpc_image_build $PROD_DEV $APT_SOURCE
 }
 
+# Compare the chunks of the new index with the previous one. The new chunks are what
+# a machine holding the previous image has to download, compressed as they are in the store.
+report_store_delta() {
+    local index=$1
+    local image=$2
+    local has_previous=false
+
+    if [ -f "$index.prev" ]; then
+        has_previous=true
+    fi
+
+    local new_bytes=$(
+        comm -13 \
+            <([ $has_previous = true ] && desync list-chunks "$index.prev" | sort -u) \
+            <(desync list-chunks "$index" | sort -u) \
+        | while read -r chunk; do
+            stat -c %s "$STORE_DIR/${chunk:0:4}/$chunk.cacnk"
+        done | awk '{ sum += $1 } END { print sum + 0 }'
+    )
+    local image_bytes=$(stat -c %s "$image")
+
+    log 1 "Chunk store: $new_bytes bytes to download from the previous image, full image is $image_bytes bytes ($(( new_bytes * 100 / image_bytes ))%)"
+    printf '{"phase":"publish_store","index":"%s","has_previous":%s,"new_chunk_bytes":%d,"image_bytes":%d}\n' \
+        "$(json_escape "$index")" $has_previous $new_bytes $image_bytes >> "$BUILD_REPORT"
+}
+
 icpc_image_build() {
     log 1 "Start building ICPC image"
-    STEPS=()
+    reset_steps
 
     if [ $1 = "prod" ]; then
         PRESEED=seeds/prod.preseed
@@ -348,20 +871,45 @@ icpc_image_build() {
         rm -rf $ICPC
     fi
 
-    rm -f $IMAGE/casper/filesystem.squashfs
+    if [ $LAYERED = true ]; then
+        # casper mounts every squashfs image in /casper and stacks them by name,
+        # so vnoi.squashfs ends up on top of the untouched filesystem.squashfs
+        SQUASHFS_SOURCE=$LAYER_UPPER
+        SQUASHFS_IMAGE=$IMAGE/casper/vnoi.squashfs
+
+        if ! findmnt "$CHROOT" > /dev/null; then
+            add_step "Mounting layers" 'mount_layers' --reads "$ICPC" --outputs "$CHROOT $LAYER_BASE"
+        fi
+    else
+        SQUASHFS_SOURCE=$CHROOT
+        SQUASHFS_IMAGE=$IMAGE/casper/filesystem.squashfs
 
-    add_step "Move preseed at $PRESEED" 'cp $PRESEED $IMAGE/preseed/icpc.seed'
+        rm -f $IMAGE/casper/filesystem.squashfs
+    fi
+
+    add_step "Move preseed at $PRESEED" 'cp $PRESEED $IMAGE/preseed/icpc.seed' \
+        --reads "$PRESEED" --outputs "$IMAGE/preseed/icpc.seed"
 
     if [ $APT_SOURCE = "vnoi" ]; then
         add_step "Changing seed to make apt use VNOI and Ubuntu sources" "$(cat <<"EOM"
 sed -i "s|https://sysopspackages.icpc.global/ubuntu|$UBUNTU_APT_SOURCE|g" $IMAGE/preseed/icpc.seed
 sed -i "s|https://sysopspackages.icpc.global|$CUSTOM_APT_SOURCE|g" $IMAGE/preseed/icpc.seed
 EOM
-        )"
+        )" --outputs "$IMAGE/preseed/icpc.seed"
     fi
 
     # TODO: (Try & Install or Install)
-    add_step "Move custom grub.cfg with custom options" 'cp grub.cfg $IMAGE/boot/grub/grub.cfg'
+    add_step "Move custom grub.cfg with custom options" 'cp grub.cfg $IMAGE/boot/grub/grub.cfg' \
+        --reads "grub.cfg" --outputs "$IMAGE/boot/grub/grub.cfg"
+
+    add_step "Prepare EFI image" "$(cat <<"EOM"
+cd $IMAGE
+dd if=/dev/zero of=efiboot.img bs=1M count=10
+mkfs.vfat efiboot.img
+LC_CTYPE=C mmd -i efiboot.img EFI EFI/boot
+LC_CTYPE=C mcopy -i efiboot.img EFI/boot/*.efi ::EFI/boot
+EOM
+    )" --reads "$IMAGE/EFI" --outputs "$IMAGE/efiboot.img"
 
     add_step "Create manifest" "$(cat <<"EOM"
 chroot $CHROOT dpkg-query -W --showformat='${Package} ${Version}\n' > $IMAGE/casper/filesystem.manifest
@@ -372,20 +920,34 @@ cp -v $IMAGE/casper/filesystem.manifest $IMAGE/casper/filesystem.manifest-deskto
     sed -i '/laptop-detect/d' $IMAGE/casper/filesystem.manifest-desktop
     sed -i '/os-prober/d' $IMAGE/casper/filesystem.manifest-desktop
 EOM
-    )"
+    )" --reads "$CHROOT" --outputs "$IMAGE/casper/filesystem.manifest $IMAGE/casper/filesystem.manifest-desktop"
 
     add_step "Compress filesystem" "$(cat <<"EOM"
-if [ $COMPACT = true ]; then
+SQUASHFS_OPTIONS=()
+if [ -n "$SORT_FILE" ]; then
+    log 2 "Sorting files by $SORT_FILE"
+    SQUASHFS_OPTIONS+=(-sort "$SORT_FILE")
+fi
+
+if [ $COMP = "xz" ]; then
     log 2 "Compressing filesystem with xz (slow, smaller size)"
-    mksquashfs $CHROOT $IMAGE/casper/filesystem.squashfs -noappend -b 1048576 -comp xz -Xdict-size 100%
+    mksquashfs $SQUASHFS_SOURCE $SQUASHFS_IMAGE -noappend -b ${BLOCK_SIZE:-1048576} -comp xz -Xdict-size 100% "${SQUASHFS_OPTIONS[@]}"
+elif [ $COMP = "zstd" ]; then
+    # Close to xz in size, but several times faster to decompress on the contestant machines
+    log 2 "Compressing filesystem with zstd (slow, smaller size, fast decompression)"
+    mksquashfs $SQUASHFS_SOURCE $SQUASHFS_IMAGE -noappend -b ${BLOCK_SIZE:-1048576} -comp zstd -Xcompression-level ${COMP_LEVEL:-15} "${SQUASHFS_OPTIONS[@]}"
 else
     log 2 "Compressing filesystem with gzip (fast, larger size)"
-    mksquashfs $CHROOT $IMAGE/casper/filesystem.squashfs -noappend -comp gzip
+    mksquashfs $SQUASHFS_SOURCE $SQUASHFS_IMAGE -noappend -b ${BLOCK_SIZE:-131072} -comp gzip ${COMP_LEVEL:+-Xcompression-level $COMP_LEVEL} "${SQUASHFS_OPTIONS[@]}"
 fi
 
 printf $(du -sx --block-size=1 $CHROOT | cut -f1) > $IMAGE/casper/filesystem.size
 EOM
-    )"
+    )" --reads "$CHROOT $SQUASHFS_SOURCE $SORT_FILE" --outputs "$SQUASHFS_IMAGE $IMAGE/casper/filesystem.size"
+
+    if [ $LAYERED = true ]; then
+        add_step "Unmounting layers" 'umount_layers'
+    fi
 
     if [ $CLEAR_EARLY = true ]; then
         add_step "Clearing early to free up space" "$(cat <<"EOM"
@@ -398,18 +960,18 @@ EOM
         )"
     fi
 
-    add_step "Building ISO" "$(cat <<"EOM"
+    add_step "Generate checksums" "$(cat <<"EOM"
 cd $IMAGE
+rm -f md5sum.txt
+find . -type f ! -name 'md5sum.txt*' ! -name efiboot.img ! -name contestant.mbr -print0 \
+    | xargs -0 -r -P $(nproc) -n 64 md5sum \
+    | LC_ALL=C sort -k 2 > md5sum.txt.new
+mv md5sum.txt.new md5sum.txt
+EOM
+    )" --reads "$IMAGE" --outputs "$IMAGE/md5sum.txt"
 
-(
-    dd if=/dev/zero of=efiboot.img bs=1M count=10 && \
-    mkfs.vfat efiboot.img && \
-    LC_CTYPE=C mmd -i efiboot.img EFI EFI/boot && \
-    LC_CTYPE=C mcopy -i efiboot.img EFI/boot/*.efi ::EFI/boot
-)
-
-rm md5sum.txt
-/bin/bash -c "(find . -type f -print0 | xargs -0 md5sum | grep -v -e 'md5sum.txt' -e 'efiboot.img' -e 'contestant.mbr' > md5sum.txt)"
+    add_step "Building ISO" "$(cat <<"EOM"
+cd $IMAGE
 
 xorriso -as mkisofs \
     -r -V "Contestant ISO" -J -joliet-long -l \
@@ -434,7 +996,28 @@ EOM
         add_step "Clearing early to free up space" 'rm -rf $IMAGE'
     fi
 
-    run_all_steps
+    if [ $PUBLISH_STORE = true ]; then
+        add_step "Publishing chunk store" "$(cat <<"EOM"
+INDEX="$INS_DIR/${IMAGE_FILENAME%.iso}.caibx"
+if [ -f "$INDEX" ]; then
+    mv "$INDEX" "$INDEX.prev"
+fi
+desync make -s $STORE_DIR "$INDEX" "$INS_DIR/$IMAGE_FILENAME"
+EOM
+        )" --reads "$INS_DIR/$IMAGE_FILENAME" \
+            --outputs "$STORE_DIR $INS_DIR/${IMAGE_FILENAME%.iso}.caibx $INS_DIR/${IMAGE_FILENAME%.iso}.caibx.prev"
+    fi
+
+    run_all_steps icpc_image_build
+
+    printf '{"phase":"icpc_image_build","iso":"%s","iso_bytes":%d,"comp":"%s","comp_level":"%s","block_size":"%s","sort_file":"%s","layered":%s}\n' \
+        "$(json_escape "$IMAGE_FILENAME")" "$(stat -c %s "$INS_DIR/$IMAGE_FILENAME")" "$COMP" "$COMP_LEVEL" "$BLOCK_SIZE" \
+        "$(json_escape "$SORT_FILE")" $LAYERED >> "$BUILD_REPORT"
+    log 1 "ISO size: $(du -h "$INS_DIR/$IMAGE_FILENAME" | cut -f1)"
+
+    if [ $PUBLISH_STORE = true ]; then
+        report_store_delta "$INS_DIR/${IMAGE_FILENAME%.iso}.caibx" "$INS_DIR/$IMAGE_FILENAME"
+    fi
 
     log 1 "Build finished. Cleaning up (run clean command for full clean up)."
 }
@@ -693,14 +1276,223 @@ dev_create() {
     log 0 "Done"
 }
 
+# Turn a fatrace log into a mksquashfs sort file. Files are ranked by their first
+# access, so the earliest files get the highest priority and are packed first.
+generate_sort_file() {
+    local trace=$1
+    local sort_file=$2
+
+    # fatrace pads the event column to three characters, e.g. "R   /usr/..." or "RO  /etc/..."
+    sed -nE 's/^.*\([0-9]+\): [A-Z+<>]*[RO][A-Z+<>]* +(\/.*)$/\1/p' "$trace" \
+        | grep -v -E '^/(proc|sys|dev|run|tmp|home|media|cdrom|root|var/log|var/tmp|opt/vnoi/store)/' \
+        | grep -v ' ' \
+        | awk '!seen[$0]++ { priority = 32768 - ++count; if (priority < 1) priority = 1; print substr($0, 2), priority }' \
+        > "$sort_file"
+}
+
+dev_boot_trace() {
+    OUTPUT="boot.sort"
+    DURATION=120
+    while [ $# -gt 0 ]; do
+    case $1 in
+        --output | -o)
+            shift
+            OUTPUT=$1
+            ;;
+        --duration | -d)
+            shift
+            DURATION=$1
+            ;;
+        -h | --help)
+            echo "Usage: $0 dev_boot_trace [--output <file>] [--duration <seconds>]"
+            echo
+            echo "Record the order in which files are accessed while the Virtual Machine boots and logs in,"
+            echo "and write it as a sort file for icpc_build --sort-file."
+            echo
+            echo "  -o, --output    Sort file to write (default: boot.sort)"
+            echo "  -d, --duration  Seconds to keep tracing after boot starts (default: 120)"
+            echo "  -h, --help      Show this help"
+            exit 0
+            ;;
+    esac
+    shift
+    done
+
+    log 0 "Checking if Virtual Machine is running"
+    if [ $(vboxmanage showvminfo --machinereadable $VM_NAME \
+    | grep -c "VMState=\"running\"") -eq 0 ]; then
+        log 0 "Not running. Run dev_reload first"
+        exit 1
+    fi
+
+    log 0 "Installing boot tracer"
+    vboxmanage guestcontrol "$VM_NAME" run \
+        --username $SUDO_USER --password $SUPER_PASSWD \
+        --exe "/bin/bash" \
+        --wait-stdout --wait-stderr \
+        -- -c "$(cat <<EOM
+apt-get install -y fatrace
+cat - <<EOF > /etc/systemd/system/vnoi-boottrace.service
+[Unit]
+Description=Trace file accesses during boot
+DefaultDependencies=no
+After=local-fs.target
+Before=sysinit.target
+
+[Service]
+Type=simple
+ExecStart=/usr/sbin/fatrace --timestamp --seconds $DURATION --output /var/log/vnoi-boottrace.log
+
+[Install]
+WantedBy=sysinit.target
+EOF
+systemctl enable vnoi-boottrace.service
+EOM
+    )"
+    log 0 "Done"
+
+    log 0 "Restarting Virtual Machine"
+    vboxmanage controlvm "$VM_NAME" acpipowerbutton
+    while true; do
+        if [ $(vboxmanage showvminfo --machinereadable $VM_NAME \
+        | grep -c "VMState=\"running\"") -eq 0 ]; then
+            break
+        fi
+        sleep 1
+    done
+    sleep 3
+
+    BOOT_START=$(date +%s)
+    vboxmanage startvm "$VM_NAME"
+
+    log 0 "Polling for guest desktop"
+    while true; do
+        if [ $(vboxmanage showvminfo --machinereadable $VM_NAME \
+        | grep -c "GuestAdditionsRunLevel=3") -ne 0 ]; then
+            break
+        fi
+        sleep 1
+    done
+    log 0 "Desktop is up after $(($(date +%s) - $BOOT_START)) seconds"
+
+    log 0 "Waiting for tracer to finish"
+    sleep $(( DURATION - ($(date +%s) - BOOT_START) > 0 ? DURATION - ($(date +%s) - BOOT_START) : 0 ))
+    sleep 5
+
+    log 0 "Collecting trace"
+    TRACE_FILE=$(mktemp /tmp/vnoi-boottrace.XXXXX)
+    vboxmanage guestcontrol "$VM_NAME" run \
+        --username $SUDO_USER --password $SUPER_PASSWD \
+        --exe "/bin/bash" \
+        --wait-stdout \
+        -- -c "systemctl disable vnoi-boottrace.service > /dev/null 2>&1; cat /var/log/vnoi-boottrace.log" > "$TRACE_FILE"
+
+    generate_sort_file "$TRACE_FILE" "$OUTPUT"
+    rm -f "$TRACE_FILE"
+    if [ ! -s "$OUTPUT" ]; then
+        echo "No file reads found in the boot trace, $OUTPUT is empty" 1>&2
+        exit 1
+    fi
+    log 0 "Wrote $(wc -l < "$OUTPUT") files to $OUTPUT"
+}
+
+# Boot an ISO in the Virtual Machine and measure the time until the live desktop is up.
+# Only development images have the guest additions needed to detect the desktop.
+dev_boot_time() {
+    ISO="$INS_DIR/contestant-dev.iso"
+    LABEL=""
+    REPORT="boot-report.jsonl"
+    while [ $# -gt 0 ]; do
+    case $1 in
+        --iso)
+            shift
+            ISO=$1
+            ;;
+        --label)
+            shift
+            LABEL=$1
+            ;;
+        -h | --help)
+            echo "Usage: $0 dev_boot_time [--iso <file>] [--label <label>]"
+            echo
+            echo "Boot the Virtual Machine from a development ISO and append the time until the live"
+            echo "desktop is up to boot-report.jsonl. The Virtual Machine is restored to snapshot"
+            echo "root-install afterwards."
+            echo
+            echo "  --iso      ISO to boot (default: $INS_DIR/contestant-dev.iso)"
+            echo "  --label    Name of the configuration in the report (default: the ISO file name)"
+            echo "  -h, --help Show this help"
+            exit 0
+            ;;
+    esac
+    shift
+    done
+
+    ISO=$(realpath "$ISO")
+    LABEL=${LABEL:-$(basename "$ISO")}
+
+    log 0 "Turning off VM"
+    vboxmanage controlvm "$VM_NAME" poweroff || true
+    while true; do
+        if [ $(vboxmanage showvminfo --machinereadable $VM_NAME \
+        | grep -c "VMState=\"running\"") -eq 0 ]; then
+            break
+        fi
+        sleep 1
+    done
+    sleep 2
+
+    log 0 "Attaching $ISO"
+    vboxmanage storageattach "$VM_NAME" \
+        --storagectl IDE \
+        --port 0 \
+        --device 0 \
+        --type dvddrive \
+        --medium "$ISO"
+    vboxmanage modifyvm "$VM_NAME" --boot1 dvd --boot2 disk
+
+    BOOT_START=$(date +%s)
+    vboxmanage startvm "$VM_NAME"
+
+    log 0 "Polling for guest desktop"
+    while true; do
+        if [ $(vboxmanage showvminfo --machinereadable $VM_NAME \
+        | grep -c "GuestAdditionsRunLevel=3") -ne 0 ]; then
+            break
+        fi
+        sleep 1
+    done
+    BOOT_TIME=$(($(date +%s) - $BOOT_START))
+    log 0 "Desktop is up after $BOOT_TIME seconds"
+
+    printf '{"label":"%s","iso":"%s","iso_bytes":%d,"seconds_to_desktop":%d}\n' \
+        "$(json_escape "$LABEL")" "$(json_escape "$ISO")" "$(stat -c %s "$ISO")" $BOOT_TIME >> "$REPORT"
+
+    # The live image starts installing right away, so throw the disk state away
+    log 0 "Restoring VM to snapshot root-install"
+    vboxmanage controlvm "$VM_NAME" poweroff
+    while true; do
+        if [ $(vboxmanage showvminfo --machinereadable $VM_NAME \
+        | grep -c "VMState=\"running\"") -eq 0 ]; then
+            break
+        fi
+        sleep 1
+    done
+    sleep 2
+    vboxmanage snapshot "$VM_NAME" restore "root-install"
+    log 0 "Done"
+}
+
 OPTIND=1 # Reset in case getopts has been used previously in the shell.
 
 help() {
-    echo "Usage: $0 {icpc_build|dev_create|dev_reload|generate_actions_secret|clean|help}"
+    echo "Usage: $0 {icpc_build|dev_create|dev_reload|dev_boot_trace|dev_boot_time|generate_actions_secret|clean|help}"
     echo
     echo "  icpc_build: Build the ISO image based on the ICPC image"
     echo "  dev_create: Build the ISO image for development and create Virtual Machine. Run \" $0 dev_create --help\" for more options"
     echo "  dev_reload: Reload the Virtual Machine with the latest changes"
+    echo "  dev_boot_trace: Record the files accessed during boot as a sort file for icpc_build --sort-file"
+    echo "  dev_boot_time: Measure the time until the live desktop of an ISO is up"
     echo "  generate_actions_secret: Generate actions secret from config.local.sh"
     echo "  clean: Clean up all files generated by this script"
     echo "  help: Show this help"
@@ -729,6 +1521,14 @@ case $1 in
         assert_nonroot
         dev_create $@
         ;;
+    dev_boot_trace)
+        assert_nonroot
+        dev_boot_trace $@
+        ;;
+    dev_boot_time)
+        assert_nonroot
+        dev_boot_time $@
+        ;;
     help)
         help
         ;;
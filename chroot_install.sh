@@ -66,6 +66,8 @@ apt-get install -y \
     p7zip-full \
     wireguard-tools \
     wireguard \
+    nftables \
+    inotify-tools \
     python3-psutil \
     nginx \
     libnginx-mod-rtmp
@@ -4,6 +4,13 @@ export INS_DIR="./live-build" # Installation directory
 export CHROOT=$INS_DIR/chroot
 export IMAGE=$INS_DIR/image
 export ICPC=$INS_DIR/icpc
+export CACHE_DIR=$INS_DIR/cache # Step keys and chroot checkpoints for icpc_build --cache
+export BUILD_REPORT=$INS_DIR/build-report.jsonl # Per-step timing report
+export STEP_LOG_DIR=$INS_DIR/logs # Per-step output of build.sh
+export STORE_DIR=$INS_DIR/store # Chunk store published by icpc_build --publish-store
+export LAYER_BASE=$INS_DIR/layers/base # Mount point of the ICPC filesystem for icpc_build --layered
+export LAYER_UPPER=$INS_DIR/layers/upper # VNOI changes on top of the ICPC filesystem
+export LAYER_WORK=$INS_DIR/layers/work
 
 export ICPC_URL="https://image.icpc.global/icpc2023/ubuntu-22.04.1-icpc2023-20240207-amd64.iso" # ICPC image URL
 export UBUNTU_APT_SOURCE="http://archive.ubuntu.com/ubuntu" # Ubuntu APT source
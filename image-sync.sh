@@ -0,0 +1,120 @@
+#!/bin/bash
+
+# Rebuild a new contest image from the previous one, downloading only the chunks
+# that changed. Indexes and stores are published by "build.sh icpc_build --publish-store".
+
+set -e
+
+STORES=()
+INDEX=""
+SEED=""
+OUTPUT=""
+WORK_PARENT=/var/tmp
+
+log() {
+    echo -e "\e[32m$1\e[0m"
+}
+
+usage() {
+    echo "Usage: $0 --index <url|file> --store <url|dir> [--store <url|dir>]... [--seed <file|device>] --output <file|device> [--work-dir <dir>]"
+    echo
+    echo "  --index   Chunk index of the new image (contestant.caibx)"
+    echo "  --store   Chunk store to download from. Can be given more than once, stores are"
+    echo "            tried in order, so put peer directories before the HTTP mirror"
+    echo "  --seed    Previous image, as a file or as the USB stick it was written to"
+    echo "  --output  Where to write the new image. A device is written after the image is complete"
+    echo "  --work-dir  Where to keep the downloaded chunks, and the complete image when writing to a"
+    echo "            device (default: $WORK_PARENT). Needs free space for the full image, so avoid tmpfs"
+    echo "  -h, --help  Show this help"
+}
+
+while [ $# -gt 0 ]; do
+case $1 in
+    --index)
+        shift
+        INDEX=$1
+        ;;
+    --store)
+        shift
+        STORES+=("$1")
+        ;;
+    --seed)
+        shift
+        SEED=$1
+        ;;
+    --output)
+        shift
+        OUTPUT=$1
+        ;;
+    --work-dir)
+        shift
+        WORK_PARENT=$1
+        ;;
+    -h | --help)
+        usage
+        exit 0
+        ;;
+    *)
+        usage
+        exit 1
+        ;;
+esac
+shift
+done
+
+if [ -z "$INDEX" ] || [ -z "$OUTPUT" ] || [ ${#STORES[@]} -eq 0 ]; then
+    usage
+    exit 1
+fi
+
+if [ ! -x "$(command -v desync)" ]; then
+    echo "desync not found, install it with: go install github.com/folbricht/desync/cmd/desync@latest" 1>&2
+    exit 1
+fi
+
+# When writing to a device the complete image is kept here, which does not fit in RAM on most machines
+if [ "$(findmnt -no FSTYPE -T "$WORK_PARENT")" = "tmpfs" ]; then
+    echo "Warning: $WORK_PARENT is in memory (tmpfs), use --work-dir to keep the image on disk" 1>&2
+fi
+WORK_DIR=$(mktemp -d "$WORK_PARENT/image-sync.XXXXX")
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+if [[ "$INDEX" =~ ^https?:// ]]; then
+    log "Downloading index $INDEX"
+    curl -fsSL "$INDEX" -o "$WORK_DIR/image.caibx"
+    INDEX="$WORK_DIR/image.caibx"
+fi
+
+STORE_OPTIONS=()
+for store in "${STORES[@]}"; do
+    STORE_OPTIONS+=(-s "$store")
+done
+
+# desync finds the seed data next to its index, with the .caibx extension removed
+SEED_OPTIONS=()
+if [ -n "$SEED" ]; then
+    log "Indexing seed $SEED"
+    ln -s "$(realpath "$SEED")" "$WORK_DIR/seed"
+    desync make "$WORK_DIR/seed.caibx" "$WORK_DIR/seed"
+    SEED_OPTIONS+=(--seed "$WORK_DIR/seed.caibx")
+fi
+
+TARGET=$OUTPUT
+if [ -b "$OUTPUT" ]; then
+    TARGET="$WORK_DIR/image.iso"
+fi
+
+# Every chunk that is not found in the seed is downloaded once and kept in the cache,
+# so the size of the cache is the amount of data transferred
+log "Extracting image"
+desync extract "${STORE_OPTIONS[@]}" "${SEED_OPTIONS[@]}" -c "$WORK_DIR/cache" "$INDEX" "$TARGET"
+
+if [ -b "$OUTPUT" ]; then
+    log "Writing image to $OUTPUT"
+    dd if="$TARGET" of="$OUTPUT" bs=4M conv=fsync status=progress
+fi
+
+mkdir -p "$WORK_DIR/cache"
+TRANSFERRED=$(find "$WORK_DIR/cache" -type f -printf '%s\n' | awk '{ sum += $1 } END { print sum + 0 }')
+IMAGE_SIZE=$(stat -c %s "$TARGET")
+log "Transferred $TRANSFERRED bytes, full image is $IMAGE_SIZE bytes ($(( TRANSFERRED * 100 / IMAGE_SIZE ))%)"
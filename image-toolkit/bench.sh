@@ -0,0 +1,203 @@
+#!/bin/bash
+set +e
+
+DIRNAME="$(dirname "$0")"
+VERSION=$(cat /opt/vnoi/misc/VERSION 2>/dev/null || echo unknown)
+RESULT_DIR=/opt/vnoi/store/bench
+
+export WARMUP=1
+export REPEAT=5
+STACKS="off on"
+THRESHOLD=10
+SAVE_BASELINE=false
+BASELINE=""
+OUTPUT=""
+
+log() {
+    echo -e "\e[36m$1\e[0m"
+}
+
+usage() {
+    echo "Usage: $0 [options] [benchmark...]"
+    echo
+    echo "  --repeat <n>      Timed runs of each benchmark (default: $REPEAT)"
+    echo "  --warmup <n>      Untimed runs before the timed ones (default: $WARMUP)"
+    echo "  --stack <mode>    Run with the streaming stack off, on, or both (default: both)"
+    echo "  --baseline <file> Baseline to compare with (default: $RESULT_DIR/baseline-$VERSION.json)"
+    echo "  --threshold <pct> Slowdown of the median that is reported as a regression (default: $THRESHOLD)"
+    echo "  --save-baseline   Save the results as the baseline of this image"
+    echo "  --output <file>   Where to write the results (default: $RESULT_DIR/<time>.json)"
+    echo "  -h, --help        Show this help"
+    echo
+    echo "Benchmarks are the names of the files in bench/ without .bench.sh, all of them by default."
+}
+
+BENCHMARKS=()
+while [ $# -gt 0 ]; do
+case $1 in
+    --repeat)
+        shift
+        REPEAT=$1
+        ;;
+    --warmup)
+        shift
+        WARMUP=$1
+        ;;
+    --stack)
+        shift
+        case $1 in
+            off|on) STACKS=$1 ;;
+            both) STACKS="off on" ;;
+            *) usage; exit 1 ;;
+        esac
+        ;;
+    --baseline)
+        shift
+        BASELINE=$1
+        ;;
+    --threshold)
+        shift
+        THRESHOLD=$1
+        ;;
+    --save-baseline)
+        SAVE_BASELINE=true
+        ;;
+    --output)
+        shift
+        OUTPUT=$1
+        ;;
+    -h | --help)
+        usage
+        exit 0
+        ;;
+    -*)
+        usage
+        exit 1
+        ;;
+    *)
+        BENCHMARKS+=("$1")
+        ;;
+esac
+shift
+done
+
+if [ ${#BENCHMARKS[@]} -eq 0 ]; then
+    BENCHMARKS=(gcc java kotlin python)
+fi
+
+mkdir -p "$RESULT_DIR"
+OUTPUT=${OUTPUT:-$RESULT_DIR/$(date +%Y%m%d-%H%M%S).json}
+BASELINE=${BASELINE:-$RESULT_DIR/baseline-$VERSION.json}
+
+export BENCH_SAMPLES=$(mktemp -q /tmp/bench.XXXXX.tsv)
+
+source "$DIRNAME/tests/wait.sh"
+
+# The streaming stack is the screen/webcam streams started by startup.sh at login,
+# and the recording service that reads them. Remember what was running to restore it.
+RECORD_WAS_ACTIVE=false
+STARTUP_WAS_RUNNING=false
+systemctl is-active --quiet ffmpeg-record.service && RECORD_WAS_ACTIVE=true
+[ -f /run/icpc-startup.pid ] && kill -0 "$(cat /run/icpc-startup.pid)" 2>/dev/null && STARTUP_WAS_RUNNING=true
+
+# startup.sh is normally started by the desktop session and captures its display, so it is
+# started again with the DISPLAY and XAUTHORITY of the running startup.sh or the icpc session
+SESSION_ENV=()
+for pid in $($STARTUP_WAS_RUNNING && cat /run/icpc-startup.pid) $(pgrep -u icpc -n gnome-shell); do
+    mapfile -t SESSION_ENV < <(tr '\0' '\n' < /proc/$pid/environ 2>/dev/null | grep -E '^(DISPLAY|XAUTHORITY)=')
+    if printf '%s\n' "${SESSION_ENV[@]}" | grep -q '^DISPLAY='; then
+        break
+    fi
+    SESSION_ENV=()
+done
+
+start_startup() {
+    if [ ! -f /run/icpc-startup.pid ]; then
+        env "${SESSION_ENV[@]}" setsid /opt/vnoi/sbin/startup.sh > /dev/null 2>&1 < /dev/null &
+    fi
+}
+
+stack_off() {
+    systemctl stop ffmpeg-record.service
+    if [ -f /run/icpc-startup.pid ]; then
+        kill -- -"$(cat /run/icpc-startup.pid)" 2>/dev/null
+        rm -f /run/icpc-startup.pid
+    fi
+}
+
+# Start the stack and wait until it streams, fails if it does not come up
+stack_on() {
+    local playlist=/var/www/html/stream/hls/stream.m3u8
+
+    if [ ${#SESSION_ENV[@]} -eq 0 ]; then
+        echo "No graphical session found for the icpc user, cannot start the streaming stack" 1>&2
+        return 1
+    fi
+    # nginx writes the playlist again for every segment, so a removed playlist
+    # only comes back once the screen is actually being streamed
+    rm -f "$playlist"
+    start_startup
+    systemctl start ffmpeg-record.service
+    if ! wait_for_file "$playlist" 120; then
+        echo "$playlist was not written within 2 minutes, the screen stream is not working" 1>&2
+        return 1
+    fi
+    if ! wait_for_unit ffmpeg-record.service 30; then
+        echo "ffmpeg-record.service is $(systemctl is-active ffmpeg-record.service)" 1>&2
+        return 1
+    fi
+}
+
+restore_stack() {
+    if $STARTUP_WAS_RUNNING || $RECORD_WAS_ACTIVE; then
+        if $STARTUP_WAS_RUNNING; then
+            start_startup
+        fi
+        if $RECORD_WAS_ACTIVE; then
+            systemctl start ffmpeg-record.service
+        fi
+    else
+        stack_off
+    fi
+    rm -f "$BENCH_SAMPLES"
+}
+trap 'restore_stack' EXIT
+
+FAILED=0
+for stack in $STACKS; do
+    log "Running benchmarks with the streaming stack $stack"
+    if ! stack_$stack; then
+        echo -e "\e[31mFAIL streaming stack could not be turned $stack, skipping its benchmarks\e[0m"
+        FAILED=1
+        continue
+    fi
+    for benchmark in "${BENCHMARKS[@]}"; do
+        STACK=$stack "$DIRNAME/bench/$benchmark.bench.sh"
+        exitcode=$?
+        if [[ $exitcode -ne 0 ]] ; then
+            echo -e "\e[31mFAIL $benchmark.bench.sh exited with status $exitcode\e[0m"
+            FAILED=1
+        fi
+    done
+done
+
+log "Writing results to $OUTPUT"
+REPORT_OPTIONS=(--output "$OUTPUT" --version "$VERSION" --warmup "$WARMUP" --threshold "$THRESHOLD")
+if ! $SAVE_BASELINE && [ -f "$BASELINE" ]; then
+    REPORT_OPTIONS+=(--baseline "$BASELINE")
+fi
+python3 "$DIRNAME/bench/report.py" "$BENCH_SAMPLES" "${REPORT_OPTIONS[@]}"
+exitcode=$?
+
+if $SAVE_BASELINE; then
+    cp "$OUTPUT" "$BASELINE"
+    log "Saved baseline $BASELINE"
+elif [ ! -f "$BASELINE" ]; then
+    log "No baseline for $VERSION, save one with --save-baseline"
+fi
+
+if [[ $exitcode -ne 0 ]] ; then
+    log "\e[31mRegressions found against $BASELINE"
+    exit 1
+fi
+exit $FAILED
@@ -0,0 +1,47 @@
+set -e
+
+CMD=$(basename "$0")
+
+unhandled_error() {
+	local lineno="$1"
+	local code="${2:-1}"
+	echo "$CMD: Error at or near line ${lineno}; exiting with status ${code}"
+	exit 2
+}
+
+interrupt_handler() {
+    >&2 echo "Interrupted"
+    exit 2
+}
+
+trap 'unhandled_error ${LINENO}' ERR
+trap 'interrupt_handler' SIGINT
+
+# Set by bench.sh, the defaults allow running a single benchmark file by hand
+WARMUP=${WARMUP:-1}
+REPEAT=${REPEAT:-5}
+STACK=${STACK:-unknown}
+BENCH_SAMPLES=${BENCH_SAMPLES:-/dev/stdout}
+
+WORK_DIR=$(mktemp -q -d /tmp/bench.XXXXX)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Run a shell command $WARMUP times, then time it $REPEAT times.
+# Appends one "<stack> <name> <nanoseconds>" line per sample to $BENCH_SAMPLES.
+# The command fails the benchmark if it fails, a slow wrong answer is not a result.
+measure() {
+    local name="$1"
+    local command="$2"
+    local start end
+
+    echo -e "\e[33mBENCH\e[0m\t$CMD $name ($STACK)"
+    for (( i = 0; i < WARMUP; i++ )); do
+        eval "$command" > /dev/null
+    done
+    for (( i = 0; i < REPEAT; i++ )); do
+        start=$(date +%s%N)
+        eval "$command" > /dev/null
+        end=$(date +%s%N)
+        printf '%s\t%s\t%s\n' "$STACK" "$name" $(( end - start )) >> "$BENCH_SAMPLES"
+    done
+}
@@ -0,0 +1,77 @@
+#!/bin/bash
+source "$(dirname "$0")/common.sh"
+
+# A typical template-heavy solution: bits/stdc++.h, ranges, lambdas and many
+# container instantiations, so the front end dominates the compile time
+cat > "$WORK_DIR/heavy.cpp" << EOF
+#include <bits/stdc++.h>
+using namespace std;
+
+template <int N> struct fib { static constexpr long long value = fib<N - 1>::value + fib<N - 2>::value; };
+template <> struct fib<1> { static constexpr long long value = 1; };
+template <> struct fib<0> { static constexpr long long value = 0; };
+
+template <class T> struct segtree {
+    int n;
+    vector<T> t;
+    segtree(int n) : n(n), t(2 * n) {}
+    void update(int p, T v) { for (t[p += n] = v; p > 1; p >>= 1) t[p >> 1] = t[p] + t[p ^ 1]; }
+    T query(int l, int r) { T res{}; for (l += n, r += n; l < r; l >>= 1, r >>= 1) { if (l & 1) res = res + t[l++]; if (r & 1) res = res + t[--r]; } return res; }
+};
+
+template <class... Ts> auto solve(Ts... xs) {
+    tuple<map<Ts, vector<Ts>>...> maps;
+    tuple<set<Ts>...> sets;
+    tuple<unordered_map<Ts, deque<Ts>>...> hashes;
+    tuple<priority_queue<pair<Ts, Ts>>...> queues;
+    tuple<segtree<Ts>...> trees{segtree<Ts>(16)...};
+    return make_tuple(get<0>(maps).size() + get<0>(sets).size() + get<0>(hashes).size() + get<0>(queues).size(), sizeof...(xs), get<0>(trees).query(0, 1));
+}
+
+int main() {
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+    vector<int> v(100);
+    iota(v.begin(), v.end(), 0);
+    auto even = v | views::filter([](int x) { return x % 2 == 0; }) | views::transform([](int x) { return x * x; });
+    long long sum = accumulate(even.begin(), even.end(), 0LL);
+    auto r = solve(1, 2LL, 3u, 4.0, 5.0f, (short)6, 'a', string("b"), (unsigned long long)9, (long double)10);
+    sort(v.begin(), v.end(), greater<>());
+    ranges::sort(v);
+    cout << sum + fib<60>::value + get<1>(r) << '\n';
+    return 0;
+}
+EOF
+
+# g++ -x c++ -g -O2 -std=gnu++20 -static ${files}, split into compiling and linking
+measure "c++20 template-heavy compile" "g++ -x c++ -g -O2 -std=gnu++20 -c '$WORK_DIR/heavy.cpp' -o '$WORK_DIR/heavy.o'"
+measure "c++20 static link" "g++ -g -O2 -std=gnu++20 -static '$WORK_DIR/heavy.o' -o '$WORK_DIR/heavy.out'"
+
+# gcc -x c -g -O2 -std=gnu11 -static ${files} -lm
+cat > "$WORK_DIR/hello.c" << EOF
+#include <stdio.h>
+
+int main() {
+    puts("Hello world!");
+    return 0;
+}
+EOF
+measure "c11 compile and static link" "gcc -x c -g -O2 -std=gnu11 -static '$WORK_DIR/hello.c' -lm -o '$WORK_DIR/hello.out'"
+measure "static binary start-up" "'$WORK_DIR/hello.out'"
+
+# Buffered stdin/stdout throughput, the usual fast I/O pattern on 10^7 integers
+cat > "$WORK_DIR/io.cpp" << EOF
+#include <iostream>
+
+int main() {
+    std::ios::sync_with_stdio(false);
+    std::cin.tie(nullptr);
+    long long x;
+    while (std::cin >> x)
+        std::cout << x + 1 << '\n';
+    return 0;
+}
+EOF
+g++ -x c++ -g -O2 -std=gnu++20 -static "$WORK_DIR/io.cpp" -o "$WORK_DIR/io.out"
+seq 1 10000000 > "$WORK_DIR/io.in"
+measure "c++ stdin/stdout 10^7 integers" "'$WORK_DIR/io.out' < '$WORK_DIR/io.in'"
@@ -0,0 +1,28 @@
+#!/bin/bash
+source "$(dirname "$0")/common.sh"
+
+cat > "$WORK_DIR/bench.java" << EOF
+import java.io.*;
+import java.util.*;
+
+public class bench {
+    public static void main(String[] args) throws IOException {
+        BufferedReader in = new BufferedReader(new InputStreamReader(System.in));
+        PrintWriter out = new PrintWriter(new BufferedWriter(new OutputStreamWriter(System.out)));
+        String line;
+        while ((line = in.readLine()) != null)
+            out.println(Long.parseLong(line) + 1);
+        out.flush();
+    }
+}
+EOF
+echo 1 > "$WORK_DIR/small.in"
+seq 1 2000000 > "$WORK_DIR/io.in"
+
+# javac -encoding UTF-8 -sourcepath . -d . ${files}
+measure "javac compile" "javac -encoding UTF-8 -sourcepath '$WORK_DIR' -d '$WORK_DIR' '$WORK_DIR/bench.java'"
+
+# java -Dfile.encoding=UTF-8 -XX:+UseSerialGC -Xss64m -Xms1920m -Xmx1920m
+JAVA="java -Dfile.encoding=UTF-8 -XX:+UseSerialGC -Xss64m -Xms1920m -Xmx1920m -classpath '$WORK_DIR' bench"
+measure "java start-up" "$JAVA < '$WORK_DIR/small.in'"
+measure "java stdin/stdout 2*10^6 lines" "$JAVA < '$WORK_DIR/io.in'"
@@ -0,0 +1,18 @@
+#!/bin/bash
+source "$(dirname "$0")/common.sh"
+
+cat > "$WORK_DIR/main.kt" << EOF
+fun main(@Suppress("UNUSED_PARAMETER") args: Array<String>) {
+    val out = System.out.bufferedWriter()
+    for (line in System.\`in\`.bufferedReader().lineSequence())
+        out.write("\${line.toLong() + 1}\n")
+    out.flush()
+}
+EOF
+echo 1 > "$WORK_DIR/small.in"
+
+# kotlinc -d . ${files}
+measure "kotlinc compile" "kotlinc -d '$WORK_DIR' '$WORK_DIR/main.kt'"
+
+# kotlin -Dfile.encoding=UTF-8 -J-XX:+UseSerialGC -J-Xss64m -J-Xms1920m -J-Xmx1920m
+measure "kotlin start-up" "kotlin -Dfile.encoding=UTF-8 -J-XX:+UseSerialGC -J-Xss64m -J-Xms1920m -J-Xmx1920m -classpath '$WORK_DIR' MainKt < '$WORK_DIR/small.in'"
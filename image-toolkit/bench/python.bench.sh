@@ -0,0 +1,15 @@
+#!/bin/bash
+source "$(dirname "$0")/common.sh"
+
+cat > "$WORK_DIR/io.py" << EOF
+import sys
+out = []
+for line in sys.stdin.buffer:
+    out.append(str(int(line) + 1))
+sys.stdout.write('\n'.join(out))
+EOF
+seq 1 2000000 > "$WORK_DIR/io.in"
+
+measure "pypy3 start-up" "pypy3 -c pass"
+measure "python3 start-up" "python3 -c pass"
+measure "pypy3 stdin/stdout 2*10^6 lines" "pypy3 '$WORK_DIR/io.py' < '$WORK_DIR/io.in'"
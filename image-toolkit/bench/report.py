@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+# Summarize the samples written by bench.sh into a JSON report, and compare
+# the medians with a baseline report of the same image.
+
+import argparse
+import json
+import socket
+import statistics
+import sys
+import time
+
+parser = argparse.ArgumentParser()
+parser.add_argument('samples')
+parser.add_argument('--output', required=True)
+parser.add_argument('--version', default='unknown')
+parser.add_argument('--warmup', type=int, default=0)
+parser.add_argument('--baseline')
+parser.add_argument('--threshold', type=float, default=10)
+args = parser.parse_args()
+
+samples = {}
+with open(args.samples) as f:
+    for line in f:
+        stack, name, ns = line.rstrip('\n').split('\t')
+        samples.setdefault((stack, name), []).append(int(ns) / 1e6)
+
+results = []
+for (stack, name), values in samples.items():
+    results.append({
+        'name': name,
+        'stack': stack,
+        'samples_ms': [round(v, 3) for v in values],
+        'min_ms': round(min(values), 3),
+        'median_ms': round(statistics.median(values), 3),
+        'mean_ms': round(statistics.mean(values), 3),
+        'stdev_ms': round(statistics.stdev(values), 3) if len(values) > 1 else 0,
+    })
+
+report = {
+    'host': socket.gethostname(),
+    'version': args.version,
+    'time': int(time.time()),
+    'warmup': args.warmup,
+    'results': results,
+}
+
+baseline = {}
+if args.baseline:
+    with open(args.baseline) as f:
+        for result in json.load(f)['results']:
+            baseline[(result['stack'], result['name'])] = result
+
+# A regression is a median slower than the baseline by more than the threshold,
+# and by more than the noise of both runs, so a single noisy sample does not flag it
+regressions = 0
+print(f"{'stack':<6} {'benchmark':<36} {'median':>10} {'stdev':>9} {'baseline':>10} {'change':>8}")
+for result in results:
+    line = f"{result['stack']:<6} {result['name']:<36} {result['median_ms']:>8.1f}ms {result['stdev_ms']:>7.1f}ms"
+    base = baseline.get((result['stack'], result['name']))
+    if base:
+        change = (result['median_ms'] - base['median_ms']) / base['median_ms'] * 100
+        result['baseline_median_ms'] = base['median_ms']
+        result['change_percent'] = round(change, 1)
+        result['regression'] = (change > args.threshold and
+                                result['median_ms'] - base['median_ms'] > result['stdev_ms'] + base['stdev_ms'])
+        line += f" {base['median_ms']:>8.1f}ms {change:>+7.1f}%"
+        if result['regression']:
+            regressions += 1
+            line = f"\033[31m{line}  REGRESSION\033[0m"
+    print(line)
+
+report['regressions'] = regressions
+with open(args.output, 'w') as f:
+    json.dump(report, f, indent=2)
+
+sys.exit(1 if regressions else 0)
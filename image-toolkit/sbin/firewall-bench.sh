@@ -0,0 +1,132 @@
+#!/bin/bash
+
+# Measure reload latency and per-packet cost of firewall.sh with large allowlists,
+# compared to the same allowlist as a linear iptables chain.
+# Also checks that an allowlist with overlapping entries is loaded and enforced.
+# Runs in a throwaway network namespace, so the firewall of this machine is not touched.
+# Usage: firewall-bench.sh [allowlist sizes...]
+
+set -e
+
+SIZES=${@:-100 1000 10000 50000}
+PACKETS=${PACKETS:-200000}
+NS="vnoi-fwbench"
+WORK_DIR=$(mktemp -d /tmp/firewall-bench.XXXXX)
+TARGET="10.255.255.254"
+
+cleanup() {
+	ip netns delete $NS 2> /dev/null || true
+	rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+now_ms() {
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# Average nanoseconds per sendto() of a UDP packet to $TARGET. The output hook
+# runs synchronously in sendto(), and the dummy interface discards the packet.
+ns_per_packet() {
+	ip netns exec $NS python3 -c '
+import socket, sys, time
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+n = int(sys.argv[1])
+start = time.perf_counter_ns()
+for _ in range(n):
+    s.sendto(b"x", (sys.argv[2], 9))
+print((time.perf_counter_ns() - start) // n)
+' $PACKETS $TARGET
+}
+
+# Succeeds if a UDP packet to <address> <port> passes the output chain
+can_send() {
+	ip netns exec $NS python3 -c '
+import socket, sys
+try:
+    socket.socket(socket.AF_INET, socket.SOCK_DGRAM).sendto(b"x", (sys.argv[1], int(sys.argv[2])))
+except PermissionError:
+    sys.exit(1)
+' "$1" "$2"
+}
+
+# A subnet with a host inside it, and a port range with a port inside it, overlap in the
+# allowlist set. They must be merged, otherwise nft rejects the whole allowlist.
+check_overlaps() {
+	printf '%s\n' "10.0.1.0/24 udp 3478" "10.0.1.5 udp 3478" "10.0.1.5 udp 3000-4000" \
+		"10.0.2.5 udp 5000-6000" "10.0.2.5 udp 5500" > "$WORK_DIR/allowlist"
+	ALLOWLIST="$WORK_DIR/allowlist" ip netns exec $NS /opt/vnoi/sbin/firewall.sh start
+
+	local failed=0
+	for allowed in "10.0.1.9 3478" "10.0.1.5 3478" "10.0.1.5 3000" "10.0.1.5 4000" "10.0.2.5 5500" "10.0.2.5 6000"; do
+		can_send $allowed || { echo "Overlapping allowlist: $allowed is blocked"; failed=1; }
+	done
+	for blocked in "10.0.1.5 4001" "10.0.2.5 4999"; do
+		! can_send $blocked || { echo "Overlapping allowlist: $blocked is allowed"; failed=1; }
+	done
+
+	ip netns exec $NS /opt/vnoi/sbin/firewall.sh stop
+	if [ $failed -ne 0 ]; then
+		exit 1
+	fi
+	echo "Overlapping allowlist: OK"
+}
+
+# Print <size> allowlist entries, with the packet target last so a linear chain has to walk all of them
+make_allowlist() {
+	local size=$1
+	for (( i = 1; i < size; i++ )); do
+		echo "10.$(( i >> 16 & 255 )).$(( i >> 8 & 255 )).$(( i & 255 )) udp 9"
+	done
+	echo "$TARGET udp 9"
+}
+
+ip netns add $NS
+ip -n $NS link set lo up
+ip -n $NS link add dummy0 type dummy
+ip -n $NS addr add 10.255.0.1/16 dev dummy0
+ip -n $NS link set dummy0 up
+ip -n $NS route add 10.0.0.0/8 dev dummy0
+
+check_overlaps
+
+echo "Baseline without firewall: $(ns_per_packet) ns/packet"
+echo
+printf "%10s %16s %16s %16s %20s %20s\n" entries nft_reload_ms nft_update_ms nft_ns/packet iptables_reload_ms iptables_ns/packet
+
+for size in $SIZES; do
+	make_allowlist $size > "$WORK_DIR/allowlist"
+
+	# nftables: full atomic reload, then allowlist-only update
+	start=$(now_ms)
+	ALLOWLIST="$WORK_DIR/allowlist" ip netns exec $NS /opt/vnoi/sbin/firewall.sh start
+	nft_reload=$(( $(now_ms) - start ))
+
+	start=$(now_ms)
+	ALLOWLIST="$WORK_DIR/allowlist" ip netns exec $NS /opt/vnoi/sbin/firewall.sh allowlist
+	nft_update=$(( $(now_ms) - start ))
+
+	nft_packet=$(ns_per_packet)
+	ip netns exec $NS /opt/vnoi/sbin/firewall.sh stop
+
+	# iptables: one rule per entry
+	{
+		echo "*filter"
+		echo ":INPUT ACCEPT [0:0]"
+		echo ":FORWARD ACCEPT [0:0]"
+		echo ":OUTPUT DROP [0:0]"
+		awk '{ print "-A OUTPUT -d " $1 " -p " $2 " --dport " $3 " -j ACCEPT" }' "$WORK_DIR/allowlist"
+		echo "COMMIT"
+	} > "$WORK_DIR/iptables.save"
+
+	start=$(now_ms)
+	ip netns exec $NS iptables-restore < "$WORK_DIR/iptables.save"
+	iptables_reload=$(( $(now_ms) - start ))
+
+	iptables_packet=$(ns_per_packet)
+	ip netns exec $NS iptables -P OUTPUT ACCEPT
+	ip netns exec $NS iptables -F
+
+	printf "%10d %16d %16d %16d %20d %20d\n" $size $nft_reload $nft_update $nft_packet $iptables_reload $iptables_packet
+done
+
+# vim: ft=sh ts=4 noet
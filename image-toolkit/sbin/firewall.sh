@@ -4,45 +4,280 @@ set -e
 
 source /opt/vnoi/config.sh
 
+RULESET=/opt/vnoi/misc/firewall.nft
+ALLOWLIST=${ALLOWLIST:-/opt/vnoi/config/allowlist}
+
+# Print "elements = { ... }" for a comma-separated list, or nothing if it is empty,
+# since nft does not accept an empty element list
+elements() {
+	if [ -n "$1" ]; then
+		echo "elements = { $1 }"
+	fi
+}
+
+# Resolve host names through /etc/hosts (or DNS), and print their IPv4 addresses comma-separated
+resolve() {
+	for host in "$@"; do
+		if [ -n "$host" ]; then
+			getent ahostsv4 "$host" | awk '{ print $1 }'
+		fi
+	done | sort -u | paste -sd ',' | sed -e 's/,/, /g'
+}
+
+# Allowlist entries are "<address>[/<prefix>] <tcp|udp> <port>[-<port>]", one per line.
+# Prints the valid entries of the files or stdin, and reports the others, since the list
+# is pushed by the server and one bad element would make nft reject the whole transaction.
+valid_entries() {
+	awk '
+		function valid_address(address,    parts, octets, n, i, value) {
+			n = split(address, parts, "/")
+			if (n > 2 || split(parts[1], octets, ".") != 4)
+				return 0
+			value = 0
+			for (i = 1; i <= 4; i++) {
+				if (octets[i] !~ /^[0-9]+$/ || octets[i] + 0 > 255)
+					return 0
+				value = value * 256 + octets[i]
+			}
+			if (n == 1)
+				return 1
+			# nft rejects prefixes with host bits set
+			return parts[2] ~ /^[0-9]+$/ && parts[2] + 0 <= 32 && value % 2 ^ (32 - parts[2]) == 0
+		}
+		function valid_port(port,    range, n, i) {
+			n = split(port, range, "-")
+			if (n > 2)
+				return 0
+			for (i = 1; i <= n; i++)
+				if (range[i] !~ /^[0-9]+$/ || range[i] + 0 < 1 || range[i] + 0 > 65535)
+					return 0
+			return n == 1 || range[1] + 0 <= range[2] + 0
+		}
+		/^[[:space:]]*(#|$)/ { next }
+		NF == 3 && valid_address($1) && ($2 == "tcp" || $2 == "udp") && valid_port($3) {
+			if (!seen[$0]++)
+				print $1, $2, $3
+			next
+		}
+		{ print "Ignoring invalid allowlist entry: " $0 > "/dev/stderr" }
+	' "$@"
+}
+
+# The allowlist set is a concatenation with intervals, where the kernel rejects elements that
+# overlap (EEXIST), e.g. a subnet and a host inside it, or 5000-6000 and 5500. Merges the valid
+# entries on stdin so that none overlap: port ranges of the same address and protocol are merged,
+# and ports already allowed for an enclosing subnet are removed from the narrower entries.
+# Since two prefixes either nest or are disjoint, the result covers the same traffic without overlaps.
+reduce_entries() {
+	awk '
+		function address(n,    i, octets) {
+			for (i = 4; i >= 1; i--) {
+				octets[i] = n % 256
+				n = int(n / 256)
+			}
+			return octets[1] "." octets[2] "." octets[3] "." octets[4]
+		}
+		# Sorts and merges "<lo>-<hi>" ranges separated by spaces
+		function merge(list,    ranges, lo, hi, bounds, n, i, j, t, out, cur_lo, cur_hi) {
+			n = split(list, ranges, " ")
+			for (i = 1; i <= n; i++) {
+				split(ranges[i], bounds, "-")
+				lo[i] = bounds[1] + 0
+				hi[i] = bounds[2] + 0
+				for (j = i; j > 1 && lo[j - 1] > lo[j]; j--) {
+					t = lo[j]; lo[j] = lo[j - 1]; lo[j - 1] = t
+					t = hi[j]; hi[j] = hi[j - 1]; hi[j - 1] = t
+				}
+			}
+			out = ""
+			for (i = 1; i <= n; i++) {
+				if (i > 1 && lo[i] <= cur_hi + 1) {
+					if (hi[i] > cur_hi)
+						cur_hi = hi[i]
+					continue
+				}
+				if (i > 1)
+					out = out " " cur_lo "-" cur_hi
+				cur_lo = lo[i]
+				cur_hi = hi[i]
+			}
+			return n ? substr(out " " cur_lo "-" cur_hi, 2) : ""
+		}
+		# Removes the merged ranges of cover from the merged ranges of list
+		function subtract(list, cover,    ranges, covers, bounds, n, m, i, j, lo, hi, out) {
+			n = split(list, ranges, " ")
+			m = split(cover, covers, " ")
+			out = ""
+			for (i = 1; i <= n; i++) {
+				split(ranges[i], bounds, "-")
+				lo = bounds[1] + 0
+				hi = bounds[2] + 0
+				for (j = 1; j <= m && lo <= hi; j++) {
+					split(covers[j], bounds, "-")
+					if (bounds[2] + 0 < lo || bounds[1] + 0 > hi)
+						continue
+					if (bounds[1] + 0 > lo)
+						out = out " " lo "-" (bounds[1] - 1)
+					lo = bounds[2] + 1
+				}
+				if (lo <= hi)
+					out = out " " lo "-" hi
+			}
+			return substr(out, 2)
+		}
+		{
+			split($1, parts, "/")
+			bits = (2 in parts) ? parts[2] + 0 : 32
+			split(parts[1], octets, ".")
+			net = ((octets[1] * 256 + octets[2]) * 256 + octets[3]) * 256 + octets[4]
+			port = ($3 ~ /-/) ? $3 : $3 "-" $3
+			key = $2 " " net " " bits
+			if (!(key in ports))
+				order[++count] = key
+			# Only the prefix lengths in use can hold an enclosing subnet
+			if (!(bits in used))
+				lengths[++length_count] = bits
+			used[bits] = 1
+			ports[key] = ports[key] " " port
+		}
+		END {
+			for (i = 1; i <= count; i++)
+				ports[order[i]] = merge(ports[order[i]])
+			for (i = 1; i <= count; i++) {
+				split(order[i], k, " ")
+				cover = ""
+				for (l = 1; l <= length_count; l++) {
+					b = lengths[l]
+					if (b >= k[3])
+						continue
+					outer = k[1] " " (k[2] - k[2] % 2 ^ (32 - b)) " " b
+					if (outer in ports)
+						cover = cover " " ports[outer]
+				}
+				left = cover == "" ? ports[order[i]] : subtract(ports[order[i]], merge(cover))
+				n = split(left, ranges, " ")
+				for (j = 1; j <= n; j++) {
+					split(ranges[j], bounds, "-")
+					print address(k[2]) (k[3] < 32 ? "/" k[3] : ""), k[1], bounds[1] == bounds[2] ? bounds[1] : ranges[j]
+				}
+			}
+		}
+	'
+}
+
+# Prints the allowlist in $1 (default: $ALLOWLIST) as nft elements, one per line,
+# since the list can be too long for a command line
+allowlist_elements() {
+	local file=${1:-$ALLOWLIST}
+
+	if [ -f "$file" ]; then
+		valid_entries "$file" 2> >(logger -p local0.warning -t FIREWALL) | reduce_entries |
+			awk '{ printf "%s%s . %s . %s", (n++ ? ",\n" : ""), $1, $2, $3 } END { if (n) print "" }'
+	fi
+}
+
+# Replace the content of the allowlist set with the entries in $1 (default: $ALLOWLIST)
+# in a single transaction. If nft still rejects it, the entries are loaded one by one
+# so that one bad element does not leave the set empty.
+load_allowlist() {
+	local elements=$(allowlist_elements "$1")
+	local element failed=0
+
+	if {
+		echo "flush set inet vnoi allowlist"
+		if [ -n "$elements" ]; then
+			echo "add element inet vnoi allowlist {"
+			echo "$elements"
+			echo "}"
+		fi
+	} | /usr/sbin/nft -f -; then
+		return 0
+	fi
+
+	logger -p local0.warning "FIREWALL: allowlist rejected as a whole, loading entries one by one"
+	/usr/sbin/nft flush set inet vnoi allowlist
+	while read -r element; do
+		if [ -n "$element" ] && ! /usr/sbin/nft add element inet vnoi allowlist "{ ${element%,} }"; then
+			logger -p local0.err "FIREWALL: rejected allowlist entry ${element%,}"
+			failed=1
+		fi
+	done <<< "$elements"
+	return $failed
+}
+
+ruleset() {
+	sed -e "s#{ADMIN_SUBNET_ELEMENTS}#$(elements "$ADMIN_SUBNET")#g" \
+		-e "s#{COACH_SUBNET_ELEMENTS}#$(elements "$COACH_SUBNET")#g" \
+		-e "s#{WEBSERVER_ELEMENTS}#$(elements "$(resolve "$WEBSERVER_PUBLIC_DOMAIN_NAME")")#g" \
+		-e "s#{VPN_ELEMENTS}#$(elements "$(resolve "$VPN_CORE_DOMAIN_NAME")")#g" \
+		-e "s#{NTP_ELEMENTS}#$(elements "$(resolve ntp.ubuntu.com time.windows.com)")#g" \
+		"$RULESET"
+}
+
+is_started() {
+	/usr/sbin/nft list table inet vnoi > /dev/null 2>&1
+}
+
 case "$1" in
-	start)
-		cat /opt/vnoi/misc/iptables.save | \
-			sed -e 's#{ADMIN_SUBNET}#'${ADMIN_SUBNET}'#g' | \
-			sed -e 's#{COACH_SUBNET}#'${COACH_SUBNET}'#g' | \
-			sed -e 's#{WEBSERVER_PUBLIC_DOMAIN_NAME}#'${WEBSERVER_PUBLIC_DOMAIN_NAME}'#g' | \
-			/usr/sbin/iptables-restore
-		/usr/sbin/ip6tables -P INPUT DROP
-		/usr/sbin/ip6tables -P OUTPUT DROP
+	start|restart)
+		# The old ruleset is replaced in the same transaction, so there is no window
+		# where the machine is left unprotected
+		ruleset | /usr/sbin/nft -f -
 		logger -p local0.info "FIREWALL: started"
+		# Loaded on its own, so a failure leaves the base ruleset in place
+		if ! load_allowlist; then
+			logger -p local0.err "FIREWALL: failed to load the allowlist"
+		fi
 		;;
 	stop)
-		/usr/sbin/iptables -P INPUT ACCEPT
-		/usr/sbin/iptables -P OUTPUT ACCEPT
-		/usr/sbin/ip6tables -P INPUT ACCEPT
-		/usr/sbin/ip6tables -P OUTPUT ACCEPT
-		/usr/sbin/iptables -F
-		/usr/sbin/ip6tables -F
+		if is_started; then
+			/usr/sbin/nft delete table inet vnoi
+		fi
 		logger -p local0.info "FIREWALL: stopped"
 		;;
-	restart)
-		/usr/sbin/iptables -P INPUT ACCEPT
-		/usr/sbin/iptables -P OUTPUT ACCEPT
-		/usr/sbin/ip6tables -P INPUT ACCEPT
-		/usr/sbin/ip6tables -P OUTPUT ACCEPT
-		/usr/sbin/iptables -F
-		/usr/sbin/ip6tables -F
-		logger -p local0.info "FIREWALL: stopped"
-
-		cat /opt/vnoi/misc/iptables.save | \
-			sed -e 's#{ADMIN_SUBNET}#'${ADMIN_SUBNET}'#g' | \
-			sed -e 's#{COACH_SUBNET}#'${COACH_SUBNET}'#g' | \
-			/usr/sbin/iptables-restore
-		/usr/sbin/ip6tables -P INPUT DROP
-		/usr/sbin/ip6tables -P OUTPUT DROP
-		logger -p local0.info "FIREWALL: started"
+	allowlist)
+		# Replace the allowlist with the entries in $2 (default: /opt/vnoi/config/allowlist)
+		# without reloading the ruleset
+		if [ -n "$2" ] && [ "$2" != "$ALLOWLIST" ]; then
+			cp "$2" "$ALLOWLIST"
+		fi
+		if is_started; then
+			load_allowlist
+		fi
+		logger -p local0.info "FIREWALL: allowlist updated with $(valid_entries "$ALLOWLIST" 2> /dev/null | wc -l) entries"
+		;;
+	allow|revoke)
+		# Add or remove a single allowlist entry: firewall.sh allow <address> <tcp|udp> <port>
+		if [ $# -ne 4 ]; then
+			echo "Usage: $0 $1 <address> <tcp|udp> <port>"
+			exit 1
+		fi
+		entry="$2 $3 $4"
+		if [ -z "$(echo "$entry" | valid_entries)" ]; then
+			exit 1
+		fi
+		touch "$ALLOWLIST"
+		if [ "$1" = "allow" ]; then
+			cp "$ALLOWLIST" "$ALLOWLIST.new"
+			grep -qxF "$entry" "$ALLOWLIST" || echo "$entry" >> "$ALLOWLIST.new"
+		else
+			grep -vxF "$entry" "$ALLOWLIST" > "$ALLOWLIST.new" || true
+		fi
+		# The whole set is reloaded, since the entry can overlap others, and the file
+		# is only changed once the running set accepted the change
+		if is_started && ! load_allowlist "$ALLOWLIST.new"; then
+			rm -f "$ALLOWLIST.new"
+			load_allowlist || true
+			exit 1
+		fi
+		mv "$ALLOWLIST.new" "$ALLOWLIST"
+		logger -p local0.info "FIREWALL: $1 $entry"
+		;;
+	status)
+		/usr/sbin/nft list table inet vnoi
 		;;
 	*)
-		echo Must specify start or stop
+		echo Must specify start, stop, allowlist, allow, revoke or status
 		;;
 esac
 
@@ -45,17 +45,18 @@ sed -i '/^SHELL/ s/\/sh$/\/bash/' /etc/default/useradd
 
 echo "Copy VNOI stuffs into /opt"
 mkdir -p /opt/vnoi
-cp -a bin sbin misc tests /opt/vnoi/
+cp -a bin sbin misc tests bench /opt/vnoi/
 
 # Limit access and execution to root and its group
 chmod 770 -R /opt/vnoi/bin/
 chmod 770 -R /opt/vnoi/sbin/
 chmod 770 -R /opt/vnoi/misc/
 chmod 770 -R /opt/vnoi/tests/
+chmod 770 -R /opt/vnoi/bench/
 
 cp config.sh /opt/vnoi/
-cp tests.sh /opt/vnoi/
-chmod 770 /opt/vnoi/tests.sh
+cp tests.sh bench.sh /opt/vnoi/
+chmod 770 /opt/vnoi/tests.sh /opt/vnoi/bench.sh
 
 mkdir -p /opt/vnoi/run
 mkdir -p /opt/vnoi/store
@@ -131,6 +132,29 @@ EOM
 
 chmod +x /etc/gdm3/PostSession/Default
 
+# Apply firewall allowlist updates (pushed by the server on login) without reloading the ruleset
+cat - <<'EOM' > /etc/systemd/system/vnoi-allowlist.service
+[Unit]
+Description=Update firewall allowlist
+
+[Service]
+Type=oneshot
+ExecStart=/opt/vnoi/sbin/firewall.sh allowlist
+EOM
+
+cat - <<'EOM' > /etc/systemd/system/vnoi-allowlist.path
+[Unit]
+Description=Watch firewall allowlist
+
+[Path]
+PathChanged=/opt/vnoi/config/allowlist
+
+[Install]
+WantedBy=multi-user.target
+EOM
+
+systemctl enable vnoi-allowlist.path
+
 # Screencast
 mkdir -p /opt/vnoi/misc/records/
 
@@ -2,50 +2,126 @@
 set +e
 
 DIRNAME="$(dirname "$0")"
-export CASE_COUNT=0
-export PASS_COUNT=0
+RESULT_DIR=/opt/vnoi/store/tests
+
+JOBS=$(nproc)
+TIMEOUT=300
+OUTPUT=""
 
 log() {
     echo -e "\e[36m$1\e[0m"
 }
 
+usage() {
+    echo "Usage: $0 [options] [test...]"
+    echo
+    echo "  -j, --jobs <n>      Test files to run at the same time (default: $JOBS)"
+    echo "  --timeout <seconds> Time limit of each test file (default: $TIMEOUT)"
+    echo "  --output <file>     Where to write the results (default: $RESULT_DIR/<time>.json)"
+    echo "  -h, --help          Show this help"
+    echo
+    echo "Tests are the names of the files in tests/ without .test.sh, all of them by default."
+    echo "The results are also copied to $RESULT_DIR/latest.json for collection."
+}
+
+TESTS=()
+while [ $# -gt 0 ]; do
+case $1 in
+    -j | --jobs)
+        shift
+        JOBS=$1
+        ;;
+    --timeout)
+        shift
+        TIMEOUT=$1
+        ;;
+    --output)
+        shift
+        OUTPUT=$1
+        ;;
+    -h | --help)
+        usage
+        exit 0
+        ;;
+    -*)
+        usage
+        exit 1
+        ;;
+    *)
+        TESTS+=("$1.test.sh")
+        ;;
+esac
+shift
+done
+
+# A job limit of 0 would start nothing and wait forever
+if [[ ! $JOBS =~ ^[1-9][0-9]*$ ]] || [[ ! $TIMEOUT =~ ^([0-9]+\.?[0-9]*|\.[0-9]+)$ ]] || \
+   [[ $TIMEOUT =~ ^[0.]+$ ]]; then
+    usage
+    exit 1
+fi
+
+if [ ${#TESTS[@]} -eq 0 ]; then
+    # The slowest files first, so they do not end up running alone at the end
+    TESTS=(
+        stream.test.sh
+        kotlin.test.sh
+        java.test.sh
+        network.test.sh
+        gcc.test.sh
+        python.test.sh
+        permission.test.sh
+    )
+fi
+
+mkdir -p "$RESULT_DIR"
+OUTPUT=${OUTPUT:-$RESULT_DIR/$(date +%Y%m%d-%H%M%S).json}
+
+WORK_DIR=$(mktemp -q -d /tmp/tests.XXXXX)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Each file writes its output and results to its own files, which are printed when it
+# finishes so the output of concurrent tests is not interleaved
 run_test() {
-    # https://stackoverflow.com/a/12451419
-    exec 5>&1
-    OUTPUT=$( "$DIRNAME/tests/$1" | tee >(cat - >&5); exit ${PIPESTATUS[0]} )
-    exitcode=$?
+    local name=$1
+    local start=$(date +%s%3N)
 
-    CASE_COUNT=$((
-        $CASE_COUNT +
-        $(
-            echo "$OUTPUT" |
-            sed -e 's/\x1b\[[0-9;]*m//g' |
-            grep '^CASE [0-9;]*' | wc -l
-        )
-    ))
-    PASS_COUNT=$((
-        $PASS_COUNT +
-        $(
-            echo "$OUTPUT" |
-            sed -e 's/\x1b\[[0-9;]*m//g' |
-            grep '^PASS' |
-            wc -l
-        )
-    ))
-
-    if [[ $exitcode -eq 2 ]] ; then
-        exit 2
-    fi
+    TEST_RESULTS="$WORK_DIR/$name.tsv" timeout --kill-after=10 "$TIMEOUT" \
+        "$DIRNAME/tests/$name" > "$WORK_DIR/$name.log" 2>&1
+    local exitcode=$?
+    echo "$exitcode $(( $(date +%s%3N) - start ))" > "$WORK_DIR/$name.status"
+    exit $exitcode
 }
 
 log "Running all tests"
 
-run_test network.test.sh
-run_test stream.test.sh
-run_test gcc.test.sh
-run_test python.test.sh
-run_test java.test.sh
-run_test kotlin.test.sh
-run_test permission.test.sh
+START=$(date +%s%3N)
+declare -A running=()  # pid -> test file
+next=0
+while [[ $next -lt ${#TESTS[@]} || ${#running[@]} -gt 0 ]]; do
+    while [[ $next -lt ${#TESTS[@]} && ${#running[@]} -lt $JOBS ]]; do
+        run_test "${TESTS[next]}" &
+        running[$!]=${TESTS[next]}
+        next=$(( next + 1 ))
+    done
+
+    wait -n -p finished_pid "${!running[@]}"
+    exitcode=$?
+    name=${running[$finished_pid]}
+    unset "running[$finished_pid]"
+
+    cat "$WORK_DIR/$name.log"
+    if [[ $exitcode -eq 124 || $exitcode -eq 137 ]] ; then
+        echo -e "\e[31mFAIL $name timed out after $TIMEOUT seconds\e[0m"
+    elif [[ $exitcode -eq 2 ]] ; then
+        echo -e "\e[31mERROR $name exited with an error\e[0m"
+    fi
+done
+
+python3 "$DIRNAME/tests/report.py" "$WORK_DIR" "${TESTS[@]}" \
+    --output "$OUTPUT" --duration $(( $(date +%s%3N) - START ))
+exitcode=$?
+cp "$OUTPUT" "$RESULT_DIR/latest.json"
 
-log "Completed with \e[32m$PASS_COUNT PASSED\e[36m, \e[31m$(($CASE_COUNT - $PASS_COUNT)) FAILED\e[0m"
+log "Results written to $OUTPUT"
+exit $exitcode
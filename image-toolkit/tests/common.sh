@@ -16,7 +16,12 @@ unhandled_error() {
 }
 
 exit_handler() {
-    if [[ $? -eq 2 ]] ; then
+    local code=$?
+    # A case that neither passed nor failed was cut short, which counts as a failure
+    if [[ -n "$CASE_NAME" ]] ; then
+        record fail "Did not finish"
+    fi
+    if [[ $code -eq 2 ]] ; then
         exit 2
     else
         exit $HAS_FAILED
@@ -32,22 +37,37 @@ trap 'unhandled_error ${LINENO}' ERR
 trap 'exit_handler' EXIT
 trap 'interrupt_handler' SIGINT
 
-if [[ -z "${CASE_COUNT+x}" ]] ; then
-    CASE_COUNT=0
-    PASS_COUNT=0
-fi
+source "$(dirname "${BASH_SOURCE[0]}")/wait.sh"
+
+CASE_COUNT=0
+PASS_COUNT=0
+CASE_NAME=""
+CASE_START=0
+
+# tests.sh sets $TEST_RESULTS, one "<file> <case> <status> <milliseconds> <message>" line is appended per case
+record() {
+    if [[ -n "$TEST_RESULTS" ]] ; then
+        printf '%s\t%s\t%s\t%s\t%s\n' "$CMD" "$CASE_NAME" "$1" $(( $(date +%s%3N) - CASE_START )) \
+            "$(printf '%s' "$2" | tr '\t\n' '  ')" >> "$TEST_RESULTS"
+    fi
+    CASE_NAME=""
+}
 
 test_case() {
     CASE_COUNT=$(( $CASE_COUNT + 1 ))
+    CASE_NAME="$1"
+    CASE_START=$(date +%s%3N)
     echo -e "\e[33mCASE $CASE_COUNT\e[0m\t$CMD $1"
 }
 
 pass() {
     PASS_COUNT=$(( $PASS_COUNT + 1 ))
     echo -e "\e[32mPASS $1\e[0m"
+    record pass "$1"
 }
 
 fail() {
     HAS_FAILED=1
     echo -e "\e[31mFAIL $1\e[0m"
+    record fail "$1"
 }
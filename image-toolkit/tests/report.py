@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+
+# Collect the results written by tests.sh into a JSON report:
+# <work dir>/<file>.tsv has one line per case, <work dir>/<file>.status has
+# the exit code and duration of the file.
+
+import argparse
+import json
+import os
+import socket
+import sys
+import time
+
+parser = argparse.ArgumentParser()
+parser.add_argument('work_dir')
+parser.add_argument('tests', nargs='+')
+parser.add_argument('--output', required=True)
+parser.add_argument('--duration', type=int, default=0)
+args = parser.parse_args()
+
+
+def read(path):
+    try:
+        with open(path) as f:
+            return f.read()
+    except FileNotFoundError:
+        return ''
+
+
+try:
+    with open('/opt/vnoi/misc/VERSION') as f:
+        version = f.read().strip()
+except FileNotFoundError:
+    version = 'unknown'
+
+files = []
+for test in args.tests:
+    status = read(os.path.join(args.work_dir, test + '.status')).split()
+    exitcode, duration = (int(status[0]), int(status[1])) if status else (2, 0)
+    cases = []
+    for line in read(os.path.join(args.work_dir, test + '.tsv')).splitlines():
+        _, name, result, case_duration, message = line.split('\t')
+        cases.append({
+            'name': name,
+            'status': result,
+            'duration_ms': int(case_duration),
+            'message': message,
+        })
+    files.append({
+        'file': test,
+        'status': {0: 'pass', 1: 'fail', 124: 'timeout', 137: 'timeout'}.get(exitcode, 'error'),
+        'exit_code': exitcode,
+        'duration_ms': duration,
+        'cases': cases,
+    })
+
+passed = sum(case['status'] == 'pass' for file in files for case in file['cases'])
+failed = sum(case['status'] != 'pass' for file in files for case in file['cases'])
+report = {
+    'host': socket.gethostname(),
+    'version': version,
+    'time': int(time.time()),
+    'duration_ms': args.duration,
+    'passed': passed,
+    'failed': failed,
+    'files': files,
+}
+with open(args.output, 'w') as f:
+    json.dump(report, f, indent=2)
+
+print(f"\033[36mCompleted with \033[32m{passed} PASSED\033[36m, \033[31m{failed} FAILED\033[36m in {args.duration / 1000:.1f}s\033[0m")
+
+if any(file['status'] == 'error' for file in files):
+    sys.exit(2)
+if failed or any(file['status'] != 'pass' for file in files):
+    sys.exit(1)
@@ -2,38 +2,24 @@
 source "$(dirname "$0")/common.sh"
 
 test_case "check if stream.m3u8 exists for hls"
-file_path='/var/www/html/stream/hls/stream.m3u8'
-if [[ -f "$file_path" ]] ; then
+if wait_for_file '/var/www/html/stream/hls/stream.m3u8' 120; then
     pass
 else
-    echo "stream.m3u8 not found, retrying in 2 minutes..."
-    sleep 120
-    if [[ -f "$file" ]] ; then
-      pass
-    else
-      fail "stream.m3u8 not found"
-    fi
+    fail "stream.m3u8 not found after 2 minutes"
 fi
 
 test_case "check if ffmpeg-record.service is active"
-if systemctl is-active --quiet ffmpeg-record.service; then
+if wait_for_unit ffmpeg-record.service 30; then
     pass
 else
-    fail
+    fail "ffmpeg-record.service is $(systemctl is-active ffmpeg-record.service)"
 fi
 
 test_case "check if webcam.m3u8 exists for hls"
-file_path='/var/www/html/stream/hls/webcam.m3u8'
-if [[ -f "$file_path" ]] ; then
+if wait_for_file '/var/www/html/stream/hls/webcam.m3u8' 120; then
     pass
 else
-    echo "webcam.m3u8 not found, retrying in 2 minutes..."
-    sleep 120
-    if [[ -f "$file" ]] ; then
-      pass
-    else
-      fail "webcam.m3u8 not found"
-    fi
+    fail "webcam.m3u8 not found after 2 minutes"
 fi
 
 # check for ffmpeg process
@@ -0,0 +1,51 @@
+# Waits that return as soon as their condition holds, shared by the tests and bench.sh
+
+# Wait until a file exists, for at most $2 seconds (default 120).
+# Returns as soon as the file is created, instead of sleeping for the whole timeout.
+wait_for_file() {
+    local path="$1"
+    local deadline=$(( $(date +%s) + ${2:-120} ))
+    local dir=$(dirname "$path")
+    local left
+
+    while [[ ! -e "$path" ]] ; do
+        left=$(( deadline - $(date +%s) ))
+        if [[ $left -le 0 ]] ; then
+            return 1
+        fi
+        if [[ -d "$dir" ]] ; then
+            # The short timeout covers a file created between the check and the watch being set up
+            inotifywait -qq -t $(( left < 2 ? left : 2 )) -e create -e moved_to "$dir" || true
+        else
+            sleep 1
+        fi
+    done
+}
+
+# Wait until a systemd unit is active, for at most $2 seconds (default 120).
+# Fails as soon as the unit is stopped or failed with nothing queued to start it.
+wait_for_unit() {
+    local unit="$1"
+    local deadline=$(( $(date +%s) + ${2:-120} ))
+    local state
+
+    while : ; do
+        state=$(systemctl is-active "$unit") || true
+        case "$state" in
+            active)
+                return 0
+                ;;
+            inactive|failed)
+                # A restart (Restart=always) or start job may still be pending
+                if [[ -z "$(systemctl show -P Job "$unit")" ]] && \
+                   [[ "$(systemctl show -P SubState "$unit")" != auto-restart ]] ; then
+                    return 1
+                fi
+                ;;
+        esac
+        if [[ $(date +%s) -ge $deadline ]] ; then
+            return 1
+        fi
+        sleep 0.2
+    done
+}
@@ -1,9 +1,11 @@
+import json
 import urllib.parse as parse
 import http.server as server
 
 TEST_USER, TEST_PASSWORD = 'test-user', 'test-password'
 TEST_ACCESS_TOKEN = 'test-access-token'
 TEST_CONFIG_FILE_CONTENT = 'test-config-file-content VNOI ICPC'
+TEST_ALLOWLIST_CONTENT = '10.0.0.1 tcp 443\n10.0.1.0/24 udp 3478'
 
 class Handler(server.SimpleHTTPRequestHandler):
   def do_POST(self):
@@ -62,9 +64,9 @@ class Handler(server.SimpleHTTPRequestHandler):
     print('200')
     self.end_headers()
 
-    response = TEST_CONFIG_FILE_CONTENT
+    response = json.dumps({'config': TEST_CONFIG_FILE_CONTENT, 'allowlist': TEST_ALLOWLIST_CONTENT})
     self.wfile.write(response.encode())
-    print(TEST_CONFIG_FILE_CONTENT)
+    print(response)
 
 if __name__ == '__main__':
   server.HTTPServer(('localhost', 8080), Handler).serve_forever()
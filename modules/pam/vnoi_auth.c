@@ -219,8 +219,9 @@ int authenticate_contestant(const char *username, const char *password,
 }
 
 // Returns 1 if successful, 0 if server-side error, -1 if internal error.
-// Free config_file after use.
-int get_contestant_config(const char *access_token, const char **config_file){
+// allowlist is NULL if the server did not send one.
+// Free config_file and allowlist after use.
+int get_contestant_config(const char *access_token, const char **config_file, const char **allowlist){
   int child_rcode = 0, return_code = 1;
   char bearer_header[FIELD_MAXLEN];
   struct buffer *header_buf = NULL, *body_buf = NULL;
@@ -262,6 +263,17 @@ int get_contestant_config(const char *access_token, const char **config_file){
     goto cleanup;
   }
 
+  /* Extract firewall allowlist, optional */
+  *allowlist = NULL;
+  if (has_json_key(body_buf_data, "allowlist")){
+    *allowlist = get_json_value(body_buf_data, "allowlist");
+    if (*allowlist == NULL){
+      write_log("Allowlist extraction failed\nJSON Content: %s\n", body_buf_data);
+      return_code = -1;
+      goto cleanup;
+    }
+  }
+
   cleanup:
   curl_slist_free_all(header_list);
   return return_code;
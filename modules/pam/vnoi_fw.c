@@ -0,0 +1,63 @@
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "vnoi_fw.h"
+#include "vnoi_log.h"
+
+// Writes the allowlist next to VNOI_ALLOWLIST_FILE and renames it into place,
+// so vnoi-allowlist.path never sees a partially written file.
+// Returns 0 if successful, -1 if error encountered.
+int firewall_allowlist_write(const char *allowlist_content){
+  int child_rcode, return_code = 0;
+
+  int allowlist_fd = -1;
+  FILE *allowlist_fp = NULL;
+
+  allowlist_fd = creat(VNOI_ALLOWLIST_FILE ".new", 0600);
+  if (allowlist_fd < 0){
+    write_log("Allowlist file creation failed: %s\n", strerror(errno));
+    return_code = -1;
+    goto cleanup;
+  }
+
+  allowlist_fp = fdopen(allowlist_fd, "w");
+  if (allowlist_fp == NULL){
+    write_log("Allowlist file fdopen failed: %s\n", strerror(errno));
+    return_code = -1;
+    goto cleanup;
+  }
+
+  child_rcode = fprintf(allowlist_fp, "%s\n", allowlist_content);
+  if (child_rcode < 0){
+    write_log("Allowlist file write failed\n");
+    return_code = -1;
+    goto cleanup;
+  }
+
+  child_rcode = fclose(allowlist_fp);
+  allowlist_fp = NULL;
+  allowlist_fd = -1;
+  if (child_rcode != 0){
+    write_log("Allowlist file close failed: %s\n", strerror(errno));
+    return_code = -1;
+    goto cleanup;
+  }
+
+  child_rcode = rename(VNOI_ALLOWLIST_FILE ".new", VNOI_ALLOWLIST_FILE);
+  if (child_rcode < 0){
+    write_log("Allowlist file rename failed: %s\n", strerror(errno));
+    return_code = -1;
+    goto cleanup;
+  }
+
+  cleanup:
+  if (allowlist_fp){
+    fclose(allowlist_fp);
+  } else if (allowlist_fd >= 0){
+    close(allowlist_fd);
+  }
+  return return_code;
+}
@@ -0,0 +1 @@
+int firewall_allowlist_write(const char *allowlist_content);
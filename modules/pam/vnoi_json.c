@@ -37,3 +37,19 @@ char *get_json_value(const char *json_str, const char *key){
   json_object_put(json_obj);
   return return_str;
 }
+
+// Returns 1 if key exists and is not null, 0 otherwise.
+int has_json_key(const char *json_str, const char *key){
+  struct json_object *json_obj = json_tokener_parse(json_str);
+  struct json_object *value_obj = NULL;
+  int return_code = 0;
+
+  if (json_obj == NULL)
+    return 0;
+
+  if (json_object_object_get_ex(json_obj, key, &value_obj) && value_obj != NULL)
+    return_code = 1;
+
+  json_object_put(json_obj);
+  return return_code;
+}
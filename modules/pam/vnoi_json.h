@@ -1 +1,2 @@
 char *get_json_value(const char *json_str, const char *key);
+int has_json_key(const char *json_str, const char *key);
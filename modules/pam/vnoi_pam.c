@@ -15,6 +15,7 @@
 #include "vnoi_log.h"
 #include "vnoi_auth.h"
 #include "vnoi_wg.h"
+#include "vnoi_fw.h"
 
 void handle_pam_error(const char *p_msg, pam_handle_t *pamh, int pam_rcode){
   const char *error_msg = pam_strerror(pamh, pam_rcode);
@@ -108,6 +109,7 @@ PAM_EXTERN int pam_sm_open_session(pam_handle_t *pamh, int flags,
 
   const char *access_token = NULL;
   const char *config_content = NULL;
+  const char *allowlist_content = NULL;
   const char *username = NULL;
 
   pam_rcode = pam_get_user(pamh, &username, VNOI_USER_PROMPT);
@@ -127,7 +129,7 @@ PAM_EXTERN int pam_sm_open_session(pam_handle_t *pamh, int flags,
     goto cleanup;
   }
 
-  config_rcode = get_contestant_config(access_token, &config_content);
+  config_rcode = get_contestant_config(access_token, &config_content, &allowlist_content);
   if (config_rcode < 0){
     write_log("Config file retrieval failed due to internal error\n");
     return_code = PAM_SESSION_ERR;
@@ -148,8 +150,17 @@ PAM_EXTERN int pam_sm_open_session(pam_handle_t *pamh, int flags,
     goto cleanup;
   }
 
+  /* Write firewall allowlist. The current one stays in place on failure,
+     so this does not prevent the contestant from logging in. */
+  if (allowlist_content != NULL){
+    child_rcode = firewall_allowlist_write(allowlist_content);
+    if (child_rcode < 0)
+      write_log("Firewall allowlist write failed\n");
+  }
+
   cleanup:
   free((void*) config_content);
+  free((void*) allowlist_content);
   return return_code;
 }
 